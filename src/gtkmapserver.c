@@ -26,6 +26,7 @@
 #endif
 
 #include <locale.h>
+#include <math.h>
 
 #include <glib/gi18n-lib.h>
 #include <gtk/gtk.h>
@@ -35,6 +36,31 @@
 #endif
 
 #include "gtkmapserver.h"
+#include "gtkmapserverpack.h"
+
+enum
+{
+	PROP_0,
+	PROP_CONTEXT,
+	PROP_PREFETCH_FRAMES,
+	PROP_REDRAW_DELAY,
+	PROP_ADAPTIVE_QUALITY,
+	PROP_TARGET_TIME,
+	PROP_FAST_IMAGETYPE,
+	PROP_QUALITY_LEVEL,
+	PROP_SPLIT,
+	PROP_SPLIT_OVERLAP,
+	PROP_HISTORY_SIZE
+};
+
+enum
+{
+	EXTENT_CHANGED,
+	RENDERED,
+	LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
 
 static void gtk_mapserver_class_init (GtkMapserverClass *klass);
 static void gtk_mapserver_init (GtkMapserver *gtk_mapserver);
@@ -48,9 +74,51 @@ static void gtk_mapserver_get_property (GObject *object,
                                GValue *value,
                                GParamSpec *pspec);
 
+static void gtk_mapserver_dispose (GObject *object);
+static void gtk_mapserver_finalize (GObject *object);
+
 static gboolean gtk_mapserver_event_timer (gpointer user_data);
 static void gtk_mapserver_draw (GtkMapserver *gtkm);
-
+static void gtk_mapserver_event_occurred (GtkMapserver *gtkm);
+static void gtk_mapserver_extent_changed (GtkMapserver *gtkm);
+static guint gtk_mapserver_render_full (GtkMapserver *gtkm,
+										const GtkMapserverExtent *ext,
+										gint width,
+										gint height,
+										guint level,
+										gpointer owner,
+										GtkMapserverPriority priority,
+										GtkMapserverContextFunc func,
+										gpointer user_data);
+static void gtk_mapserver_on_fetched (GtkMapserverContext *ctx,
+									  const gchar *url,
+									  GdkPixbuf *pixbuf,
+									  gpointer user_data);
+static void gtk_mapserver_show_pixbuf (GtkMapserver *gtkm, GdkPixbuf *pixbuf);
+static void gtk_mapserver_set_shown (GtkMapserver *gtkm, GdkPixbuf *pixbuf, const GtkMapserverExtent *ext);
+static gboolean gtk_mapserver_draw_delta (GtkMapserver *gtkm, gint width, gint height);
+static gboolean gtk_mapserver_extent_equal (const GtkMapserverExtent *a, const GtkMapserverExtent *b);
+static gboolean gtk_mapserver_draw_split (GtkMapserver *gtkm, gint width, gint height);
+static void gtk_mapserver_pieces_cancel (GtkMapserver *gtkm);
+static gchar *gtk_mapserver_build_url (GtkMapserver *gtkm,
+									   const GtkMapserverExtent *ext,
+									   gint width,
+									   gint height,
+									   gint time_index,
+									   guint level);
+static GdkPixbuf *gtk_mapserver_fit_pixbuf (GdkPixbuf *pixbuf, gint width, gint height);
+static void gtk_mapserver_update_quality (GtkMapserver *gtkm, gint width, gint height);
+static void gtk_mapserver_requalify (GtkMapserver *gtkm);
+
+static void gtk_mapserver_frames_reset (GtkMapserver *gtkm);
+static void gtk_mapserver_frames_fill (GtkMapserver *gtkm);
+
+static void gtk_mapserver_rendered (GtkMapserver *gtkm);
+static void gtk_mapserver_history_remove (GtkMapserver *gtkm, guint index, guint length);
+static void gtk_mapserver_history_go (GtkMapserver *gtkm, gint index);
+
+static void gtk_mapserver_on_realize (GtkWidget *widget,
+									 gpointer user_data);
 static void gtk_mapserver_on_size_allocate (GtkWidget *widget,
 											GdkRectangle *allocation,
 											gpointer user_data);
@@ -74,17 +142,69 @@ static gboolean gtk_mapserver_on_motion_notify_event (GtkWidget *widget,
 
 #define GTK_MAPSERVER_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), GTK_TYPE_MAPSERVER, GtkMapserverPrivate))
 
+/* a slot of the time-series ring buffer */
+typedef struct
+	{
+		GtkMapserver *gtkm;
+		gint index;
+		GdkPixbuf *pixbuf;
+		guint fetch_id;
+	} GtkMapserverFrame;
+
+static GtkMapserverFrame *gtk_mapserver_frames_find (GtkMapserver *gtkm, guint index);
+
+/* a part of the view fetched into the image on screen; it is requested
+ * margin pixels larger on every side and cropped when pasted */
+typedef struct
+	{
+		GtkMapserver *gtkm;
+		gint x;
+		gint y;
+		gint width;
+		gint height;
+		gint margin;
+		guint id;
+		gboolean pending;
+	} GtkMapserverPiece;
+
+/* a view of the navigation history, with the private key its image is
+ * pinned under in the context cache */
+typedef struct
+	{
+		GtkMapserverExtent ext;
+		gint width;
+		gint height;
+		gchar *key;
+		gboolean pinned;
+	} GtkMapserverHistoryEntry;
+
 typedef struct _GtkMapserverPrivate GtkMapserverPrivate;
 struct _GtkMapserverPrivate
 	{
 		GooCanvasItem *root;
 		GooCanvasItem *img;
-		SoupSession *soup_session;
+		GtkMapserverContext *context;
+		guint fetch_id;
+		GtkMapserverExtent fetch_ext;
+		gint fetch_width;
+		gint fetch_height;
+		GtkMapserverPack *pack;
+
+		GdkPixbuf *shown;
+		GtkMapserverExtent shown_ext;
+		GPtrArray *pieces;
+		guint pieces_pending;
+		gboolean pieces_progressive;
+		gboolean pieces_failed;
+		guint split;
+		guint split_overlap;
 
 		GString *url;
 		GString *url_no_ext;
 		GtkMapserverExtent *ext;
 		GtkMapserverExtent *ext_cur;
+		gint alloc_width;
+		gint alloc_height;
 		gdouble canvas_to_ext_x;
 		gdouble canvas_to_ext_y;
 
@@ -92,11 +212,57 @@ struct _GtkMapserverPrivate
 		gdouble sel_y_start;
 
 		GSource *sevent;
+		guint redraw_delay;
+
+		gchar *time_param;
+		gchar **time_values;
+		guint n_time_values;
+		guint time_index;
+
+		guint prefetch_frames;
+		GtkMapserverFrame *frames;
+		guint n_frames;
+		GtkMapserverExtent frames_ext;
+		gint frames_width;
+		gint frames_height;
+		guint play_id;
+
+		gboolean adaptive_quality;
+		guint target_time;
+		gchar *fast_imagetype;
+		guint quality_level;
+
+		GPtrArray *history;
+		gint history_index;
+		guint history_size;
+		guint history_serial;
 	};
 
 G_DEFINE_TYPE (GtkMapserver, gtk_mapserver, GOO_TYPE_CANVAS)
 
 #define SCALE 0.1
+#define PREFETCH_FRAMES 4
+#define REDRAW_DELAY 500
+#define TARGET_TIME 1000
+#define SPLIT_OVERLAP 32
+#define HISTORY_SIZE 8
+/* a better level must be predicted this far under the target */
+#define QUALITY_MARGIN 0.7
+
+/* what mapserv is asked for at each quality level; bytes per pixel are
+ * rough sizes of a png and of a jpeg map, used to predict transfers */
+static const struct
+	{
+		gboolean fast_imagetype;
+		guint divisor;
+		gdouble bytes_per_pixel;
+	} quality_levels[] =
+	{
+		{ FALSE, 1, 0.6 },
+		{ TRUE, 1, 0.15 },
+		{ TRUE, 2, 0.15 },
+		{ TRUE, 4, 0.15 }
+	};
 
 #ifdef G_OS_WIN32
 static HMODULE hmodule;
@@ -126,6 +292,110 @@ gtk_mapserver_class_init (GtkMapserverClass *klass)
 
 	object_class->set_property = gtk_mapserver_set_property;
 	object_class->get_property = gtk_mapserver_get_property;
+	object_class->dispose = gtk_mapserver_dispose;
+	object_class->finalize = gtk_mapserver_finalize;
+
+	g_object_class_install_property (object_class, PROP_CONTEXT,
+									 g_param_spec_object ("context",
+														  "Context",
+														  "Session, cache and scheduler shared with other maps",
+														  GTK_TYPE_MAPSERVER_CONTEXT,
+														  G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class, PROP_PREFETCH_FRAMES,
+									 g_param_spec_uint ("prefetch-frames",
+														"Prefetch frames",
+														"Time-series frames fetched and decoded ahead of playback",
+														0, 64, PREFETCH_FRAMES,
+														G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class, PROP_REDRAW_DELAY,
+									 g_param_spec_uint ("redraw-delay",
+														"Redraw delay",
+														"Milliseconds without interaction before the map is requested",
+														0, G_MAXUINT, REDRAW_DELAY,
+														G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class, PROP_ADAPTIVE_QUALITY,
+									 g_param_spec_boolean ("adaptive-quality",
+														   "Adaptive quality",
+														   "Trade image quality for speed on slow links",
+														   TRUE,
+														   G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class, PROP_TARGET_TIME,
+									 g_param_spec_uint ("target-time",
+														"Target time",
+														"Milliseconds from request to image on screen the quality is adapted to",
+														1, G_MAXUINT, TARGET_TIME,
+														G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class, PROP_FAST_IMAGETYPE,
+									 g_param_spec_string ("fast-imagetype",
+														  "Fast imagetype",
+														  "Output format of the map file asked for on slow links",
+														  "jpeg",
+														  G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class, PROP_QUALITY_LEVEL,
+									 g_param_spec_uint ("quality-level",
+														"Quality level",
+														"0 is full quality; then fast-imagetype, at full, half and quarter mapsize",
+														0, G_N_ELEMENTS (quality_levels) - 1, 0,
+														G_PARAM_READABLE));
+
+	g_object_class_install_property (object_class, PROP_SPLIT,
+									 g_param_spec_uint ("split",
+														"Split",
+														"Parallel requests a full render is split into, 1 for one request",
+														1, 64, 1,
+														G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class, PROP_SPLIT_OVERLAP,
+									 g_param_spec_uint ("split-overlap",
+														"Split overlap",
+														"Pixels each piece is rendered beyond its edges, so labels are not clipped",
+														0, 1024, SPLIT_OVERLAP,
+														G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class, PROP_HISTORY_SIZE,
+									 g_param_spec_uint ("history-size",
+														"History size",
+														"Views kept for going back and forward, each pinned in the cache",
+														0, 256, HISTORY_SIZE,
+														G_PARAM_READWRITE));
+
+	/**
+	 * GtkMapserver::extent-changed:
+	 * @gtkm:
+	 *
+	 * Emitted when the home or the current extent changes.
+	 */
+	signals[EXTENT_CHANGED] = g_signal_new ("extent-changed",
+											G_TYPE_FROM_CLASS (object_class),
+											G_SIGNAL_RUN_LAST,
+											0,
+											NULL,
+											NULL,
+											g_cclosure_marshal_VOID__VOID,
+											G_TYPE_NONE,
+											0);
+
+	/**
+	 * GtkMapserver::rendered:
+	 * @gtkm:
+	 *
+	 * Emitted when the image of the current extent is on screen.
+	 */
+	signals[RENDERED] = g_signal_new ("rendered",
+									  G_TYPE_FROM_CLASS (object_class),
+									  G_SIGNAL_RUN_LAST,
+									  0,
+									  NULL,
+									  NULL,
+									  g_cclosure_marshal_VOID__VOID,
+									  G_TYPE_NONE,
+									  0);
 }
 
 static void
@@ -137,13 +407,26 @@ gtk_mapserver_init (GtkMapserver *gtk_mapserver)
 
 	priv->root = NULL;
 	priv->img = NULL;
-	priv->soup_session = NULL;
+	priv->context = NULL;
+	priv->fetch_id = 0;
+	priv->pack = NULL;
+
+	priv->shown = NULL;
+	priv->pieces = g_ptr_array_new_with_free_func (g_free);
+	priv->pieces_pending = 0;
+	priv->pieces_progressive = TRUE;
+	priv->pieces_failed = FALSE;
+	priv->split = 1;
+	priv->split_overlap = SPLIT_OVERLAP;
 
 	priv->url = NULL;
 	priv->url_no_ext = NULL;
 	priv->ext = NULL;
 	priv->ext_cur = NULL;
 
+	priv->alloc_width = 0;
+	priv->alloc_height = 0;
+
 	priv->canvas_to_ext_x = 0.0;
 	priv->canvas_to_ext_y = 0.0;
 
@@ -151,6 +434,30 @@ gtk_mapserver_init (GtkMapserver *gtk_mapserver)
 	priv->sel_y_start = 0.0;
 
 	priv->sevent = NULL;
+	priv->redraw_delay = REDRAW_DELAY;
+
+	priv->time_param = NULL;
+	priv->time_values = NULL;
+	priv->n_time_values = 0;
+	priv->time_index = 0;
+
+	priv->prefetch_frames = PREFETCH_FRAMES;
+	priv->n_frames = priv->prefetch_frames + 1;
+	priv->frames = g_new0 (GtkMapserverFrame, priv->n_frames);
+	gtk_mapserver_frames_reset (gtk_mapserver);
+	priv->frames_width = 0;
+	priv->frames_height = 0;
+	priv->play_id = 0;
+
+	priv->adaptive_quality = TRUE;
+	priv->target_time = TARGET_TIME;
+	priv->fast_imagetype = g_strdup ("jpeg");
+	priv->quality_level = 0;
+
+	priv->history = g_ptr_array_new ();
+	priv->history_index = -1;
+	priv->history_size = HISTORY_SIZE;
+	priv->history_serial = 0;
 
 #ifdef G_OS_WIN32
 
@@ -159,7 +466,7 @@ gtk_mapserver_init (GtkMapserver *gtk_mapserver)
 
 	moddir = g_win32_get_package_installation_directory_of_module (hmodule);
 
-	p = g_strrstr (moddir, g_strdup_printf ("%c", G_DIR_SEPARATOR));
+	p = g_strrstr (moddir, G_DIR_SEPARATOR_S);
 	if (p != NULL
 	    && (g_ascii_strcasecmp (p + 1, "src") == 0
 	        || g_ascii_strcasecmp (p + 1, ".libs") == 0))
@@ -187,6 +494,8 @@ gtk_mapserver_init (GtkMapserver *gtk_mapserver)
 
 	gtk_widget_set_can_focus (GTK_WIDGET (gtk_mapserver), TRUE);
 
+	g_signal_connect (G_OBJECT (gtk_mapserver), "realize",
+	                  G_CALLBACK (gtk_mapserver_on_realize), (gpointer)gtk_mapserver);
 	g_signal_connect (G_OBJECT (gtk_mapserver), "size-allocate",
 	                  G_CALLBACK (gtk_mapserver_on_size_allocate), (gpointer)gtk_mapserver);
 
@@ -214,13 +523,7 @@ gtk_mapserver_init (GtkMapserver *gtk_mapserver)
 					  G_CALLBACK (gtk_mapserver_on_key_release_event), (gpointer)gtk_mapserver);
 
 	/* Soup */
-	priv->soup_session = soup_session_sync_new_with_options (SOUP_SESSION_SSL_CA_FILE, NULL,
-															 SOUP_SESSION_ADD_FEATURE_BY_TYPE, SOUP_TYPE_CONTENT_DECODER,
-															 SOUP_SESSION_ADD_FEATURE_BY_TYPE, SOUP_TYPE_COOKIE_JAR,
-															 SOUP_SESSION_USER_AGENT, "get ",
-															 SOUP_SESSION_ACCEPT_LANGUAGE_AUTO, TRUE,
-															 SOUP_SESSION_USE_NTLM, FALSE,
-															 NULL);
+	priv->context = g_object_ref (gtk_mapserver_context_get_default ());
 }
 
 /**
@@ -257,7 +560,7 @@ SoupMessage
 	if (SOUP_IS_MESSAGE (msg))
 		{
 			soup_message_set_flags (msg, SOUP_MESSAGE_NO_REDIRECT);
-			soup_session_send_message (priv->soup_session, msg);
+			soup_session_send_message (gtk_mapserver_context_get_soup_session (priv->context), msg);
 		}
 
 	if (!SOUP_IS_MESSAGE (msg) || !SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
@@ -375,6 +678,8 @@ gtk_mapserver_set_home (GtkMapserver *gtkm,
 		{
 			g_free (priv->ext);
 			g_free (priv->ext_cur);
+			priv->ext = NULL;
+			priv->ext_cur = NULL;
 		}
 	if (ext != NULL)
 		{
@@ -412,238 +717,1879 @@ gtk_mapserver_set_home (GtkMapserver *gtkm,
 			return;
 		}
 
+	gtk_mapserver_set_shown (gtkm, NULL, NULL);
+	gtk_mapserver_history_remove (gtkm, 0, priv->history->len);
+	gtk_mapserver_context_set_viewport (priv->context, gtkm, priv->ext_cur);
 	gtk_mapserver_draw (gtkm);
+
+	g_signal_emit (gtkm, signals[EXTENT_CHANGED], 0);
 }
 
 /**
- * gtk_mapserver_get_extent:
+ * gtk_mapserver_get_url:
  * @gtkm:
- * @url:
+ * @ext:
+ * @width:
+ * @height:
  *
- * Returns: a #GtkMapserverExtent. Mapserver must returns an html page in the form "minx miny maxx maxy".
+ * Always at full quality, whatever the level the map is drawn at (see
+ * #GtkMapserver:quality-level), so the url depends only on the map and
+ * its arguments.
+ *
+ * Returns: the mapserv url that renders @ext in @width x @height pixels,
+ * or NULL if no home was set.
  */
-GtkMapserverExtent
-*gtk_mapserver_get_extent (GtkMapserver *gtkm, const gchar *url)
+gchar
+*gtk_mapserver_get_url (GtkMapserver *gtkm,
+						const GtkMapserverExtent *ext,
+						gint width,
+						gint height)
 {
-	GtkMapserverExtent *ext;
-	SoupMessage *msg;
-
-	ext = NULL;
-
-	msg = gtk_mapserver_get_soup_message (gtkm, url);
-	if (msg != NULL)
-		{
-			ext = gtk_mapserver_str_to_extent (msg->response_body->data);
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
 
-			g_object_unref (msg);
-		}
+	g_return_val_if_fail (ext != NULL, NULL);
 
-	return ext;
+	return gtk_mapserver_build_url (gtkm, ext, width, height,
+									priv->time_values != NULL ? (gint)priv->time_index : -1,
+									0);
 }
 
-/* PRIVATE */
-static void
-gtk_mapserver_set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec)
+/* time_index -1 leaves the time dimension out; above level 0 the image
+ * may come smaller than width x height */
+static gchar
+*gtk_mapserver_build_url (GtkMapserver *gtkm,
+						  const GtkMapserverExtent *ext,
+						  gint width,
+						  gint height,
+						  gint time_index,
+						  guint level)
 {
-	GtkMapserver *gtk_mapserver = GTK_MAPSERVER (object);
-	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtk_mapserver);
+	gchar *_url;
+	gchar *time_url;
+	gchar *level_url;
 
-	switch (property_id)
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (priv->url_no_ext == NULL)
 		{
-			default:
-				G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
-				break;
+			return NULL;
 		}
-}
 
-static void
-gtk_mapserver_get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec)
-{
-	GtkMapserver *gtk_mapserver = GTK_MAPSERVER (object);
-	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtk_mapserver);
+	width = MAX (1, (width + quality_levels[level].divisor - 1) / quality_levels[level].divisor);
+	height = MAX (1, (height + quality_levels[level].divisor - 1) / quality_levels[level].divisor);
 
-	switch (property_id)
+	char *lccur = g_strdup (setlocale (LC_NUMERIC, NULL));
+	setlocale (LC_NUMERIC, "C");
+
+	_url = g_strdup_printf ("%s&mapsize=%d %d&mapext=%f %f %f %f",
+							priv->url_no_ext->str,
+							width,
+							height,
+							ext->minx,
+							ext->miny,
+							ext->maxx,
+							ext->maxy);
+
+	setlocale (LC_NUMERIC, lccur);
+	g_free (lccur);
+
+	if (time_index >= 0 && time_index < (gint)priv->n_time_values)
 		{
-			default:
-				G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
-				break;
+			time_url = g_strdup_printf ("%s&%s=%s",
+										_url,
+										priv->time_param,
+										priv->time_values[time_index]);
+			g_free (_url);
+			_url = time_url;
 		}
+
+	if (quality_levels[level].fast_imagetype
+		&& priv->fast_imagetype != NULL)
+		{
+			level_url = g_strdup_printf ("%s&map.imagetype=%s",
+										 _url,
+										 priv->fast_imagetype);
+			g_free (_url);
+			_url = level_url;
+		}
+
+	return _url;
 }
 
-static gboolean
-gtk_mapserver_event_timer (gpointer user_data)
+/**
+ * gtk_mapserver_render:
+ * @gtkm:
+ * @ext:
+ * @width:
+ * @height:
+ * @func: called with the image, from the mounted pack or from mapserv.
+ * @user_data:
+ *
+ * Renders @ext through the same source and cache the map uses, at the
+ * quality level of the map, so it shares the images the map fetched;
+ * above level 0 @func may get an image smaller than asked.
+ *
+ * Returns: an id for gtk_mapserver_cancel_render(), or 0 if @func was
+ * already called.
+ */
+guint
+gtk_mapserver_render (GtkMapserver *gtkm,
+					  const GtkMapserverExtent *ext,
+					  gint width,
+					  gint height,
+					  GtkMapserverContextFunc func,
+					  gpointer user_data)
 {
-	GtkMapserver *gtkm = (GtkMapserver *)user_data;
 	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
 
-	if (gtk_widget_get_realized (GTK_WIDGET (gtkm)))
-		{
-			gtk_mapserver_draw (gtkm);
-			g_source_destroy (priv->sevent);
-			priv->sevent = NULL;
-		}
+	g_return_val_if_fail (ext != NULL, 0);
+	g_return_val_if_fail (func != NULL, 0);
 
-	return TRUE;
+	return gtk_mapserver_render_full (gtkm, ext, width, height, priv->quality_level,
+									  NULL, GTK_MAPSERVER_PRIORITY_VISIBLE,
+									  func, user_data);
 }
 
-static void
-gtk_mapserver_draw (GtkMapserver *gtkm)
+/* with an owner the request follows that owner's viewport; above
+ * quality level 0 func may get an image smaller than asked */
+static guint
+gtk_mapserver_render_full (GtkMapserver *gtkm,
+						   const GtkMapserverExtent *ext,
+						   gint width,
+						   gint height,
+						   guint level,
+						   gpointer owner,
+						   GtkMapserverPriority priority,
+						   GtkMapserverContextFunc func,
+						   gpointer user_data)
 {
-	GtkAllocation allocation;
-	gdouble x;
-	gdouble y;
-	gdouble scale;
-	gdouble rotation;
 	GdkPixbuf *pixbuf;
-
 	gchar *_url;
+	guint id;
 
 	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
 
-	gtk_widget_get_allocation (GTK_WIDGET (gtkm), &allocation);
+	if (priv->pack != NULL)
+		{
+			pixbuf = gtk_mapserver_pack_render (priv->pack, ext, width, height);
+			func (priv->context, NULL, pixbuf, user_data);
+			g_object_unref (pixbuf);
+			return 0;
+		}
 
-	priv->canvas_to_ext_x = (priv->ext_cur->maxx - priv->ext_cur->minx) / allocation.width;
-	priv->canvas_to_ext_y = (priv->ext_cur->maxy - priv->ext_cur->miny) / allocation.height;
+	_url = gtk_mapserver_build_url (gtkm, ext, width, height,
+									priv->time_values != NULL ? (gint)priv->time_index : -1,
+									level);
+	if (_url == NULL)
+		{
+			return 0;
+		}
 
-	goo_canvas_item_get_simple_transform (priv->img,
-										  &x,
-										  &y,
-										  &scale,
-										  &rotation);
+	id = gtk_mapserver_context_fetch_full (priv->context, _url,
+										   owner, ext, priority,
+										   func, user_data);
+	g_free (_url);
 
-	char *lccur = g_strdup (setlocale (LC_NUMERIC, NULL));
-	setlocale (LC_NUMERIC, "C");
+	return id;
+}
 
-	_url = g_strdup_printf ("%s&mapsize=%d %d&mapext=%f %f %f %f",
-							priv->url_no_ext->str,
-							allocation.width,
-							allocation.height,
-							priv->ext_cur->minx,
-							priv->ext_cur->miny,
-							priv->ext_cur->maxx,
-							priv->ext_cur->maxy);
+/**
+ * gtk_mapserver_cancel_render:
+ * @gtkm:
+ * @id: an id returned by gtk_mapserver_render().
+ */
+void
+gtk_mapserver_cancel_render (GtkMapserver *gtkm, guint id)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
 
-	setlocale (LC_NUMERIC, lccur);
+	gtk_mapserver_context_cancel (priv->context, id);
+}
 
-	goo_canvas_item_set_simple_transform (priv->img,
-										  0,
-										  0,
-										  1,
-										  rotation);
-	pixbuf = gtk_mapserver_get_gdk_pixbuf (gtkm, _url);
+/**
+ * gtk_mapserver_get_home_extent:
+ * @gtkm:
+ * @ext: (out):
+ *
+ * Returns: FALSE if no home was set.
+ */
+gboolean
+gtk_mapserver_get_home_extent (GtkMapserver *gtkm, GtkMapserverExtent *ext)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
 
-	g_object_set (G_OBJECT (priv->img),
-				  "pixbuf", pixbuf,
-				  NULL);
-	g_free (_url);
+	g_return_val_if_fail (ext != NULL, FALSE);
+
+	if (priv->ext == NULL)
+		{
+			return FALSE;
+		}
+
+	*ext = *priv->ext;
+	return TRUE;
 }
 
-static void
-gtk_mapserver_event_occurred (GtkMapserver *gtkm)
+/**
+ * gtk_mapserver_get_current_extent:
+ * @gtkm:
+ * @ext: (out):
+ *
+ * Returns: FALSE if no home was set.
+ */
+gboolean
+gtk_mapserver_get_current_extent (GtkMapserver *gtkm, GtkMapserverExtent *ext)
 {
 	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
 
-	if (priv->sevent != NULL)
+	g_return_val_if_fail (ext != NULL, FALSE);
+
+	if (priv->ext_cur == NULL)
 		{
-			g_source_destroy (priv->sevent);
+			return FALSE;
 		}
-	priv->sevent = g_timeout_source_new (500);
-	g_source_set_callback (priv->sevent, gtk_mapserver_event_timer, (gpointer)gtkm, NULL);
-	g_source_attach (priv->sevent, NULL);
+
+	*ext = *priv->ext_cur;
+	return TRUE;
 }
 
-/* SIGNALS */
-static void
-gtk_mapserver_on_size_allocate (GtkWidget *widget,
-								GdkRectangle *allocation,
-								gpointer user_data)
+/**
+ * gtk_mapserver_set_current_extent:
+ * @gtkm:
+ * @ext:
+ *
+ * Moves the map to @ext; the home does not change.
+ */
+void
+gtk_mapserver_set_current_extent (GtkMapserver *gtkm, const GtkMapserverExtent *ext)
 {
-	GtkMapserver *gtkm = (GtkMapserver *)user_data;
 	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
 
-	if (!gtk_widget_get_realized (GTK_WIDGET (gtkm)))
+	g_return_if_fail (ext != NULL);
+
+	if (priv->ext_cur == NULL)
 		{
+			g_warning ("You must set initial map extent.");
 			return;
 		}
 
-	gtk_mapserver_event_occurred (gtkm);
+	*priv->ext_cur = *ext;
+
+	gtk_mapserver_extent_changed (gtkm);
 }
 
-static void
-gtk_mapserver_center_map (GtkMapserver *gtkm)
+/**
+ * gtk_mapserver_can_go_back:
+ * @gtkm:
+ *
+ * Returns: TRUE if a view was left for the current one.
+ */
+gboolean
+gtk_mapserver_can_go_back (GtkMapserver *gtkm)
 {
-	GtkAllocation allocation;
-	GooCanvasBounds bounds;
-
-	gdouble x;
-	gdouble y;
-	gdouble scale;
-	gdouble rotation;
-
 	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
 
-	gtk_widget_get_allocation (GTK_WIDGET (gtkm), &allocation);
-
-	goo_canvas_item_get_bounds (priv->img, &bounds);
+	return priv->history_index > 0;
+}
 
-	goo_canvas_item_get_simple_transform (priv->img,
-										  &x,
-										  &y,
-										  &scale,
-										  &rotation);
+/**
+ * gtk_mapserver_can_go_forward:
+ * @gtkm:
+ *
+ * Returns: TRUE if the current view was reached by going back.
+ */
+gboolean
+gtk_mapserver_can_go_forward (GtkMapserver *gtkm)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
 
-	goo_canvas_item_set_simple_transform (priv->img,
-										  ((gdouble)allocation.width - (bounds.x2 - bounds.x1)) / 2,
-										  ((gdouble)allocation.height - (bounds.y2 - bounds.y1)) / 2,
-										  scale,
-										  rotation);
+	return priv->history_index >= 0
+		   && priv->history_index < (gint)priv->history->len - 1;
 }
 
-static gboolean
-gtk_mapserver_on_key_release_event (GooCanvasItem *item,
-									GooCanvasItem *target_item,
-									GdkEventKey *event,
-									gpointer user_data)
+/**
+ * gtk_mapserver_go_back:
+ * @gtkm:
+ *
+ * Moves to the view shown before the current one. Its image is still
+ * pinned in the cache, so it is on screen without asking mapserv unless
+ * the map was resized in the meantime.
+ *
+ * Returns: FALSE if there is nothing to go back to.
+ */
+gboolean
+gtk_mapserver_go_back (GtkMapserver *gtkm)
 {
-	GtkMapserver *gtkm = (GtkMapserver *)user_data;
 	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
 
-	if (!gtk_widget_get_realized (GTK_WIDGET (gtkm)))
+	if (!gtk_mapserver_can_go_back (gtkm))
 		{
 			return FALSE;
 		}
 
-	switch (event->keyval)
-		{
-			case GDK_KEY_0:
-			case GDK_KEY_KP_0:
-				{
-					gdouble x;
-					gdouble y;
-					gdouble scale;
-					gdouble rotation;
+	gtk_mapserver_history_go (gtkm, priv->history_index - 1);
 
-					goo_canvas_item_get_simple_transform (priv->img,
-														  &x,
-														  &y,
-														  &scale,
-														  &rotation);
-					goo_canvas_item_set_simple_transform (priv->img,
-														  x,
-														  y,
-														  1,
-														  rotation);
-					gtk_mapserver_center_map (gtkm);
+	return TRUE;
+}
 
-					g_free (priv->ext_cur);
-					priv->ext_cur = g_memdup (priv->ext, sizeof (GtkMapserverExtent));
+/**
+ * gtk_mapserver_go_forward:
+ * @gtkm:
+ *
+ * Undoes gtk_mapserver_go_back().
+ *
+ * Returns: FALSE if there is nothing to go forward to.
+ */
+gboolean
+gtk_mapserver_go_forward (GtkMapserver *gtkm)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
 
-					gtk_mapserver_event_occurred (gtkm);
+	if (!gtk_mapserver_can_go_forward (gtkm))
+		{
+			return FALSE;
+		}
 
-					return TRUE;
-				}
+	gtk_mapserver_history_go (gtkm, priv->history_index + 1);
 
-			case GDK_KEY_plus:
+	return TRUE;
+}
+
+/**
+ * gtk_mapserver_get_extent:
+ * @gtkm:
+ * @url:
+ *
+ * Returns: a #GtkMapserverExtent. Mapserver must returns an html page in the form "minx miny maxx maxy".
+ */
+GtkMapserverExtent
+*gtk_mapserver_get_extent (GtkMapserver *gtkm, const gchar *url)
+{
+	GtkMapserverExtent *ext;
+	SoupMessage *msg;
+
+	ext = NULL;
+
+	msg = gtk_mapserver_get_soup_message (gtkm, url);
+	if (msg != NULL)
+		{
+			ext = gtk_mapserver_str_to_extent (msg->response_body->data);
+
+			g_object_unref (msg);
+		}
+
+	return ext;
+}
+
+/**
+ * gtk_mapserver_mount_pack:
+ * @gtkm:
+ * @filename: a pack file created by the seeding tool.
+ * @error:
+ *
+ * Uses the tiles stored in @filename instead of asking mapserv, so the map
+ * works without network. If no home was set, the pack extent becomes the home.
+ *
+ * Returns: TRUE on success.
+ */
+gboolean
+gtk_mapserver_mount_pack (GtkMapserver *gtkm, const gchar *filename, GError **error)
+{
+	GtkMapserverPack *pack;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	g_return_val_if_fail (filename != NULL, FALSE);
+
+	pack = gtk_mapserver_pack_new (filename, error);
+	if (pack == NULL)
+		{
+			return FALSE;
+		}
+
+	if (priv->pack != NULL)
+		{
+			g_object_unref (priv->pack);
+		}
+	priv->pack = pack;
+	gtk_mapserver_set_shown (gtkm, NULL, NULL);
+	gtk_mapserver_history_remove (gtkm, 0, priv->history->len);
+
+	if (priv->ext == NULL)
+		{
+			priv->ext = g_new0 (GtkMapserverExtent, 1);
+			gtk_mapserver_pack_get_extent (priv->pack, priv->ext);
+			priv->ext_cur = g_memdup (priv->ext, sizeof (GtkMapserverExtent));
+		}
+
+	gtk_mapserver_context_set_viewport (priv->context, gtkm, priv->ext_cur);
+	gtk_mapserver_draw (gtkm);
+
+	g_signal_emit (gtkm, signals[EXTENT_CHANGED], 0);
+
+	return TRUE;
+}
+
+/**
+ * gtk_mapserver_unmount_pack:
+ * @gtkm:
+ *
+ * Goes back to ask mapserv for the map.
+ */
+void
+gtk_mapserver_unmount_pack (GtkMapserver *gtkm)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (priv->pack == NULL)
+		{
+			return;
+		}
+
+	g_object_unref (priv->pack);
+	priv->pack = NULL;
+	gtk_mapserver_set_shown (gtkm, NULL, NULL);
+	gtk_mapserver_history_remove (gtkm, 0, priv->history->len);
+
+	if (priv->url != NULL)
+		{
+			gtk_mapserver_draw (gtkm);
+		}
+}
+
+/**
+ * gtk_mapserver_set_time_values:
+ * @gtkm:
+ * @param: (allow-none): the url parameter carrying the time, "time" if NULL.
+ * @values: (allow-none): NULL-terminated list of time values; NULL removes
+ * the time dimension.
+ *
+ * Frame i is the current map with "&@param=@values[i]" appended to the url.
+ */
+void
+gtk_mapserver_set_time_values (GtkMapserver *gtkm, const gchar *param, const gchar * const *values)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	gtk_mapserver_stop (gtkm);
+	gtk_mapserver_frames_reset (gtkm);
+
+	g_free (priv->time_param);
+	g_strfreev (priv->time_values);
+	priv->time_param = NULL;
+	priv->time_values = NULL;
+	priv->n_time_values = 0;
+	priv->time_index = 0;
+
+	if (values != NULL && values[0] != NULL)
+		{
+			priv->time_param = g_strdup (param != NULL ? param : "time");
+			priv->time_values = g_strdupv ((gchar **)values);
+			priv->n_time_values = g_strv_length (priv->time_values);
+		}
+
+	gtk_mapserver_set_shown (gtkm, NULL, NULL);
+	gtk_mapserver_history_remove (gtkm, 0, priv->history->len);
+	gtk_mapserver_draw (gtkm);
+}
+
+/**
+ * gtk_mapserver_set_time_index:
+ * @gtkm:
+ * @index: the frame to show.
+ */
+void
+gtk_mapserver_set_time_index (GtkMapserver *gtkm, guint index)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	g_return_if_fail (index < priv->n_time_values);
+
+	priv->time_index = index;
+
+	gtk_mapserver_draw (gtkm);
+}
+
+/**
+ * gtk_mapserver_get_time_index:
+ * @gtkm:
+ *
+ * Returns: the index of the frame shown.
+ */
+guint
+gtk_mapserver_get_time_index (GtkMapserver *gtkm)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	return priv->time_index;
+}
+
+static gboolean
+gtk_mapserver_play_timer (gpointer user_data)
+{
+	GtkMapserver *gtkm = (GtkMapserver *)user_data;
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	GtkMapserverFrame *frame;
+	guint next;
+
+	gtk_mapserver_frames_fill (gtkm);
+
+	next = (priv->time_index + 1) % priv->n_time_values;
+	frame = gtk_mapserver_frames_find (gtkm, next);
+
+	/* late frame: hold the current one rather than show a blank map */
+	if (frame == NULL || frame->pixbuf == NULL)
+		{
+			return TRUE;
+		}
+
+	priv->time_index = next;
+	gtk_mapserver_show_pixbuf (gtkm, frame->pixbuf);
+
+	/* the slot just left is reused for the frame prefetch-frames ahead */
+	gtk_mapserver_frames_fill (gtkm);
+
+	return TRUE;
+}
+
+/**
+ * gtk_mapserver_play:
+ * @gtkm:
+ * @fps: target frames per second.
+ *
+ * Loops over the time values, keeping up to #GtkMapserver:prefetch-frames
+ * frames fetched and decoded ahead of the one shown. A frame not ready in
+ * time holds the previous one on screen.
+ */
+void
+gtk_mapserver_play (GtkMapserver *gtkm, gdouble fps)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	g_return_if_fail (fps > 0.0);
+
+	if (priv->time_values == NULL)
+		{
+			g_warning ("You must set time values before playing.");
+			return;
+		}
+	if (priv->pack != NULL)
+		{
+			g_warning ("Map packs have no time dimension.");
+			return;
+		}
+
+	gtk_mapserver_stop (gtkm);
+
+	gtk_mapserver_frames_fill (gtkm);
+	priv->play_id = g_timeout_add (MAX (1, (guint)(1000.0 / fps)), gtk_mapserver_play_timer, gtkm);
+}
+
+/**
+ * gtk_mapserver_stop:
+ * @gtkm:
+ */
+void
+gtk_mapserver_stop (GtkMapserver *gtkm)
+{
+	guint i;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (priv->play_id == 0)
+		{
+			return;
+		}
+
+	g_source_remove (priv->play_id);
+	priv->play_id = 0;
+
+	/* decoded frames stay, the ones still in flight are dropped */
+	for (i = 0; i < priv->n_frames; i++)
+		{
+			if (priv->frames[i].fetch_id != 0)
+				{
+					gtk_mapserver_context_cancel (priv->context, priv->frames[i].fetch_id);
+					priv->frames[i].fetch_id = 0;
+					priv->frames[i].index = -1;
+				}
+		}
+}
+
+/* PRIVATE */
+static void
+gtk_mapserver_frames_reset (GtkMapserver *gtkm)
+{
+	guint i;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	for (i = 0; i < priv->n_frames; i++)
+		{
+			GtkMapserverFrame *frame = &priv->frames[i];
+
+			if (frame->fetch_id != 0)
+				{
+					gtk_mapserver_context_cancel (priv->context, frame->fetch_id);
+					frame->fetch_id = 0;
+				}
+			if (frame->pixbuf != NULL)
+				{
+					g_object_unref (frame->pixbuf);
+					frame->pixbuf = NULL;
+				}
+			frame->gtkm = gtkm;
+			frame->index = -1;
+		}
+}
+
+static void
+gtk_mapserver_on_frame_fetched (GtkMapserverContext *ctx,
+								const gchar *url,
+								GdkPixbuf *pixbuf,
+								gpointer user_data)
+{
+	GtkMapserverFrame *frame = (GtkMapserverFrame *)user_data;
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (frame->gtkm);
+
+	frame->fetch_id = 0;
+	if (pixbuf == NULL)
+		{
+			/* retried on next tick */
+			frame->index = -1;
+			return;
+		}
+
+	frame->pixbuf = gtk_mapserver_fit_pixbuf (pixbuf, priv->frames_width, priv->frames_height);
+
+	if (frame->index == (gint)priv->time_index)
+		{
+			gtk_mapserver_show_pixbuf (frame->gtkm, frame->pixbuf);
+		}
+}
+
+static void
+gtk_mapserver_frame_release (GtkMapserver *gtkm, GtkMapserverFrame *frame)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (frame->fetch_id != 0)
+		{
+			gtk_mapserver_context_cancel (priv->context, frame->fetch_id);
+			frame->fetch_id = 0;
+		}
+	if (frame->pixbuf != NULL)
+		{
+			g_object_unref (frame->pixbuf);
+			frame->pixbuf = NULL;
+		}
+	frame->index = -1;
+}
+
+/* Returns: the slot holding time value index, or NULL. */
+static GtkMapserverFrame
+*gtk_mapserver_frames_find (GtkMapserver *gtkm, guint index)
+{
+	guint i;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	for (i = 0; i < priv->n_frames; i++)
+		{
+			if (priv->frames[i].index == (gint)index)
+				{
+					return &priv->frames[i];
+				}
+		}
+
+	return NULL;
+}
+
+/* requests the current frame and the following prefetch_frames; slots
+ * are not tied to an index, a series of any length wraps without two
+ * frames of the window competing for one slot */
+static void
+gtk_mapserver_frames_fill (GtkMapserver *gtkm)
+{
+	GtkAllocation allocation;
+	GtkMapserverFrame *frame;
+	guint ahead;
+	guint distance;
+	guint i;
+	guint k;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (priv->time_values == NULL || priv->ext_cur == NULL)
+		{
+			return;
+		}
+
+	gtk_widget_get_allocation (GTK_WIDGET (gtkm), &allocation);
+	allocation.width = MAX (1, allocation.width);
+	allocation.height = MAX (1, allocation.height);
+
+	/* frames of another view are useless */
+	if (priv->frames_ext.minx != priv->ext_cur->minx
+		|| priv->frames_ext.miny != priv->ext_cur->miny
+		|| priv->frames_ext.maxx != priv->ext_cur->maxx
+		|| priv->frames_ext.maxy != priv->ext_cur->maxy
+		|| priv->frames_width != allocation.width
+		|| priv->frames_height != allocation.height)
+		{
+			gtk_mapserver_frames_reset (gtkm);
+			priv->frames_ext = *priv->ext_cur;
+			priv->frames_width = allocation.width;
+			priv->frames_height = allocation.height;
+		}
+
+	ahead = MIN (priv->n_frames, priv->n_time_values);
+
+	/* frames left behind free their slots */
+	for (i = 0; i < priv->n_frames; i++)
+		{
+			frame = &priv->frames[i];
+			if (frame->index < 0)
+				{
+					continue;
+				}
+
+			distance = (frame->index + priv->n_time_values - priv->time_index) % priv->n_time_values;
+			if (distance >= ahead)
+				{
+					gtk_mapserver_frame_release (gtkm, frame);
+				}
+		}
+
+	for (k = 0; k < ahead; k++)
+		{
+			guint index = (priv->time_index + k) % priv->n_time_values;
+			gchar *_url;
+
+			if (gtk_mapserver_frames_find (gtkm, index) != NULL)
+				{
+					continue;
+				}
+
+			/* the window is never larger than the ring, a slot is free */
+			frame = NULL;
+			for (i = 0; i < priv->n_frames && frame == NULL; i++)
+				{
+					if (priv->frames[i].index < 0)
+						{
+							frame = &priv->frames[i];
+						}
+				}
+			frame->index = index;
+
+			_url = gtk_mapserver_build_url (gtkm,
+											&priv->frames_ext,
+											priv->frames_width,
+											priv->frames_height,
+											index,
+											priv->quality_level);
+			frame->fetch_id = gtk_mapserver_context_fetch_full (priv->context,
+																_url,
+																gtkm,
+																&priv->frames_ext,
+																k == 0 ? GTK_MAPSERVER_PRIORITY_VISIBLE : GTK_MAPSERVER_PRIORITY_PREFETCH,
+																gtk_mapserver_on_frame_fetched,
+																frame);
+			g_free (_url);
+		}
+}
+
+static void
+gtk_mapserver_set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec)
+{
+	GtkMapserver *gtk_mapserver = GTK_MAPSERVER (object);
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtk_mapserver);
+
+	switch (property_id)
+		{
+			case PROP_CONTEXT:
+				if (priv->fetch_id != 0)
+					{
+						gtk_mapserver_context_cancel (priv->context, priv->fetch_id);
+						priv->fetch_id = 0;
+					}
+				gtk_mapserver_pieces_cancel (gtk_mapserver);
+				gtk_mapserver_history_remove (gtk_mapserver, 0, priv->history->len);
+				gtk_mapserver_context_set_viewport (priv->context, gtk_mapserver, NULL);
+				g_object_unref (priv->context);
+				priv->context = g_value_get_object (value) != NULL
+								? g_value_dup_object (value)
+								: g_object_ref (gtk_mapserver_context_get_default ());
+				break;
+
+			case PROP_PREFETCH_FRAMES:
+				gtk_mapserver_frames_reset (gtk_mapserver);
+				g_free (priv->frames);
+				priv->prefetch_frames = g_value_get_uint (value);
+				priv->n_frames = priv->prefetch_frames + 1;
+				priv->frames = g_new0 (GtkMapserverFrame, priv->n_frames);
+				gtk_mapserver_frames_reset (gtk_mapserver);
+				if (priv->play_id != 0)
+					{
+						gtk_mapserver_frames_fill (gtk_mapserver);
+					}
+				break;
+
+			case PROP_REDRAW_DELAY:
+				priv->redraw_delay = g_value_get_uint (value);
+				break;
+
+			case PROP_ADAPTIVE_QUALITY:
+				priv->adaptive_quality = g_value_get_boolean (value);
+				gtk_mapserver_requalify (gtk_mapserver);
+				break;
+
+			case PROP_TARGET_TIME:
+				priv->target_time = g_value_get_uint (value);
+				gtk_mapserver_requalify (gtk_mapserver);
+				break;
+
+			case PROP_FAST_IMAGETYPE:
+				g_free (priv->fast_imagetype);
+				priv->fast_imagetype = g_value_dup_string (value);
+				/* the image on screen is of the old type */
+				if (quality_levels[priv->quality_level].fast_imagetype)
+					{
+						gtk_mapserver_set_shown (gtk_mapserver, NULL, NULL);
+					}
+				gtk_mapserver_requalify (gtk_mapserver);
+				break;
+
+			case PROP_SPLIT:
+				priv->split = g_value_get_uint (value);
+				break;
+
+			case PROP_SPLIT_OVERLAP:
+				priv->split_overlap = g_value_get_uint (value);
+				break;
+
+			case PROP_HISTORY_SIZE:
+				priv->history_size = g_value_get_uint (value);
+				if (priv->history->len > priv->history_size)
+					{
+						gtk_mapserver_history_remove (gtk_mapserver, 0, priv->history->len - priv->history_size);
+					}
+				break;
+
+			default:
+				G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+				break;
+		}
+}
+
+static void
+gtk_mapserver_get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec)
+{
+	GtkMapserver *gtk_mapserver = GTK_MAPSERVER (object);
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtk_mapserver);
+
+	switch (property_id)
+		{
+			case PROP_CONTEXT:
+				g_value_set_object (value, priv->context);
+				break;
+
+			case PROP_PREFETCH_FRAMES:
+				g_value_set_uint (value, priv->prefetch_frames);
+				break;
+
+			case PROP_REDRAW_DELAY:
+				g_value_set_uint (value, priv->redraw_delay);
+				break;
+
+			case PROP_ADAPTIVE_QUALITY:
+				g_value_set_boolean (value, priv->adaptive_quality);
+				break;
+
+			case PROP_TARGET_TIME:
+				g_value_set_uint (value, priv->target_time);
+				break;
+
+			case PROP_FAST_IMAGETYPE:
+				g_value_set_string (value, priv->fast_imagetype);
+				break;
+
+			case PROP_QUALITY_LEVEL:
+				g_value_set_uint (value, priv->quality_level);
+				break;
+
+			case PROP_SPLIT:
+				g_value_set_uint (value, priv->split);
+				break;
+
+			case PROP_SPLIT_OVERLAP:
+				g_value_set_uint (value, priv->split_overlap);
+				break;
+
+			case PROP_HISTORY_SIZE:
+				g_value_set_uint (value, priv->history_size);
+				break;
+
+			default:
+				G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+				break;
+		}
+}
+
+static void
+gtk_mapserver_dispose (GObject *object)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (object);
+
+	if (priv->sevent != NULL)
+		{
+			g_source_destroy (priv->sevent);
+			priv->sevent = NULL;
+		}
+	if (priv->context != NULL)
+		{
+			gtk_mapserver_stop (GTK_MAPSERVER (object));
+			gtk_mapserver_frames_reset (GTK_MAPSERVER (object));
+
+			if (priv->fetch_id != 0)
+				{
+					gtk_mapserver_context_cancel (priv->context, priv->fetch_id);
+					priv->fetch_id = 0;
+				}
+			gtk_mapserver_pieces_cancel (GTK_MAPSERVER (object));
+			gtk_mapserver_history_remove (GTK_MAPSERVER (object), 0, priv->history->len);
+			gtk_mapserver_context_set_viewport (priv->context, object, NULL);
+			g_object_unref (priv->context);
+			priv->context = NULL;
+		}
+	if (priv->shown != NULL)
+		{
+			g_object_unref (priv->shown);
+			priv->shown = NULL;
+		}
+	if (priv->pack != NULL)
+		{
+			g_object_unref (priv->pack);
+			priv->pack = NULL;
+		}
+
+	G_OBJECT_CLASS (gtk_mapserver_parent_class)->dispose (object);
+}
+
+static void
+gtk_mapserver_finalize (GObject *object)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (object);
+
+	g_ptr_array_free (priv->pieces, TRUE);
+	g_ptr_array_free (priv->history, TRUE);
+	g_free (priv->frames);
+	g_free (priv->time_param);
+	g_strfreev (priv->time_values);
+	g_free (priv->fast_imagetype);
+
+	if (priv->url != NULL)
+		{
+			g_string_free (priv->url, TRUE);
+			g_string_free (priv->url_no_ext, TRUE);
+		}
+	g_free (priv->ext);
+	g_free (priv->ext_cur);
+
+	G_OBJECT_CLASS (gtk_mapserver_parent_class)->finalize (object);
+}
+
+static gboolean
+gtk_mapserver_event_timer (gpointer user_data)
+{
+	GtkMapserver *gtkm = (GtkMapserver *)user_data;
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	/* an unrealized map is drawn when realized, polling would spin with
+	 * no redraw delay */
+	priv->sevent = NULL;
+	if (gtk_widget_get_realized (GTK_WIDGET (gtkm)))
+		{
+			gtk_mapserver_draw (gtkm);
+		}
+
+	return FALSE;
+}
+
+static void
+gtk_mapserver_draw (GtkMapserver *gtkm)
+{
+	GtkAllocation allocation;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (priv->ext_cur == NULL)
+		{
+			return;
+		}
+
+	gtk_widget_get_allocation (GTK_WIDGET (gtkm), &allocation);
+
+	if (priv->fetch_id != 0)
+		{
+			gtk_mapserver_cancel_render (gtkm, priv->fetch_id);
+			priv->fetch_id = 0;
+		}
+
+	/* an image still missing strips, or with a failed one left white,
+	 * is no base for the next one */
+	if (priv->pieces_pending > 0 || priv->pieces_failed)
+		{
+			gtk_mapserver_set_shown (gtkm, NULL, NULL);
+		}
+	gtk_mapserver_pieces_cancel (gtkm);
+
+	gtk_mapserver_update_quality (gtkm, MAX (1, allocation.width), MAX (1, allocation.height));
+
+	if (!gtk_mapserver_draw_delta (gtkm, MAX (1, allocation.width), MAX (1, allocation.height))
+		&& !gtk_mapserver_draw_split (gtkm, MAX (1, allocation.width), MAX (1, allocation.height)))
+		{
+			priv->fetch_ext = *priv->ext_cur;
+			priv->fetch_width = MAX (1, allocation.width);
+			priv->fetch_height = MAX (1, allocation.height);
+			priv->fetch_id = gtk_mapserver_render_full (gtkm,
+														priv->ext_cur,
+														priv->fetch_width,
+														priv->fetch_height,
+														priv->quality_level,
+														gtkm,
+														GTK_MAPSERVER_PRIORITY_VISIBLE,
+														gtk_mapserver_on_fetched,
+														gtkm);
+		}
+
+	/* draw_delta may have snapped the extent */
+	priv->canvas_to_ext_x = (priv->ext_cur->maxx - priv->ext_cur->minx) / allocation.width;
+	priv->canvas_to_ext_y = (priv->ext_cur->maxy - priv->ext_cur->miny) / allocation.height;
+
+	if (priv->play_id != 0)
+		{
+			gtk_mapserver_frames_fill (gtkm);
+		}
+}
+
+static void
+gtk_mapserver_on_fetched (GtkMapserverContext *ctx,
+						  const gchar *url,
+						  GdkPixbuf *pixbuf,
+						  gpointer user_data)
+{
+	GtkMapserver *gtkm = (GtkMapserver *)user_data;
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	priv->fetch_id = 0;
+
+	if (pixbuf != NULL)
+		{
+			pixbuf = gtk_mapserver_fit_pixbuf (pixbuf, priv->fetch_width, priv->fetch_height);
+		}
+
+	gtk_mapserver_set_shown (gtkm, pixbuf, &priv->fetch_ext);
+	gtk_mapserver_show_pixbuf (gtkm, pixbuf);
+
+	if (pixbuf != NULL)
+		{
+			g_object_unref (pixbuf);
+		}
+
+	gtk_mapserver_rendered (gtkm);
+}
+
+/* images of a degraded quality level come smaller than the view */
+static GdkPixbuf
+*gtk_mapserver_fit_pixbuf (GdkPixbuf *pixbuf, gint width, gint height)
+{
+	if (gdk_pixbuf_get_width (pixbuf) == width
+		&& gdk_pixbuf_get_height (pixbuf) == height)
+		{
+			return g_object_ref (pixbuf);
+		}
+
+	return gdk_pixbuf_scale_simple (pixbuf, width, height, GDK_INTERP_BILINEAR);
+}
+
+/* picks the best level whose image is predicted on screen within the
+ * target time, from what the context measured of the link */
+static void
+gtk_mapserver_update_quality (GtkMapserver *gtkm, gint width, gint height)
+{
+	gdouble latency;
+	gdouble throughput;
+	gdouble target;
+	gdouble predicted;
+	gdouble pixels;
+	guint level;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (!priv->adaptive_quality)
+		{
+			level = 0;
+		}
+	else if (!gtk_mapserver_context_get_link_estimate (priv->context, &latency, &throughput))
+		{
+			return;
+		}
+	else
+		{
+			target = priv->target_time / 1000.0;
+			for (level = 0; level < G_N_ELEMENTS (quality_levels) - 1; level++)
+				{
+					pixels = ((gdouble)width / quality_levels[level].divisor)
+							 * ((gdouble)height / quality_levels[level].divisor);
+					predicted = latency + pixels * quality_levels[level].bytes_per_pixel / throughput;
+
+					/* going back up needs a margin, or the level would flap */
+					if (predicted <= (level < priv->quality_level ? target * QUALITY_MARGIN : target))
+						{
+							break;
+						}
+				}
+		}
+
+	if (level != priv->quality_level)
+		{
+			priv->quality_level = level;
+
+			/* strips of another level would not match the image around them */
+			gtk_mapserver_set_shown (gtkm, NULL, NULL);
+
+			g_object_notify (G_OBJECT (gtkm), "quality-level");
+		}
+}
+
+/* a quality setting changed: the level is picked again and the map
+ * redrawn, so a degraded image does not wait for the next interaction */
+static void
+gtk_mapserver_requalify (GtkMapserver *gtkm)
+{
+	GtkAllocation allocation;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (priv->ext_cur == NULL
+		|| !gtk_widget_get_realized (GTK_WIDGET (gtkm)))
+		{
+			return;
+		}
+
+	gtk_widget_get_allocation (GTK_WIDGET (gtkm), &allocation);
+	gtk_mapserver_update_quality (gtkm, MAX (1, allocation.width), MAX (1, allocation.height));
+	gtk_mapserver_event_occurred (gtkm);
+}
+
+/* remembers what is on screen and which extent it covers */
+static void
+gtk_mapserver_set_shown (GtkMapserver *gtkm, GdkPixbuf *pixbuf, const GtkMapserverExtent *ext)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (pixbuf != NULL)
+		{
+			g_object_ref (pixbuf);
+		}
+	if (priv->shown != NULL)
+		{
+			g_object_unref (priv->shown);
+		}
+	priv->shown = pixbuf;
+
+	if (ext != NULL)
+		{
+			priv->shown_ext = *ext;
+		}
+}
+
+static void
+gtk_mapserver_pieces_cancel (GtkMapserver *gtkm)
+{
+	guint i;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	for (i = 0; i < priv->pieces->len; i++)
+		{
+			GtkMapserverPiece *piece = g_ptr_array_index (priv->pieces, i);
+
+			if (piece->id != 0)
+				{
+					gtk_mapserver_context_cancel (priv->context, piece->id);
+				}
+		}
+	g_ptr_array_set_size (priv->pieces, 0);
+	priv->pieces_pending = 0;
+	priv->pieces_failed = FALSE;
+}
+
+static void
+gtk_mapserver_on_piece_fetched (GtkMapserverContext *ctx,
+								const gchar *url,
+								GdkPixbuf *pixbuf,
+								gpointer user_data)
+{
+	GtkMapserverPiece *piece = (GtkMapserverPiece *)user_data;
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (piece->gtkm);
+
+	piece->id = 0;
+	piece->pending = FALSE;
+	priv->pieces_pending--;
+
+	if (pixbuf != NULL && priv->shown != NULL)
+		{
+			pixbuf = gtk_mapserver_fit_pixbuf (pixbuf,
+											   piece->width + 2 * piece->margin,
+											   piece->height + 2 * piece->margin);
+			gdk_pixbuf_copy_area (pixbuf,
+								  piece->margin, piece->margin,
+								  piece->width, piece->height,
+								  priv->shown,
+								  piece->x, piece->y);
+			g_object_unref (pixbuf);
+
+			if (priv->pieces_progressive)
+				{
+					g_object_set (G_OBJECT (priv->img),
+								  "pixbuf", priv->shown,
+								  NULL);
+				}
+		}
+	else if (pixbuf == NULL)
+		{
+			/* left white */
+			priv->pieces_failed = TRUE;
+		}
+
+	if (priv->pieces_pending == 0)
+		{
+			if (!priv->pieces_progressive && priv->shown != NULL)
+				{
+					gtk_mapserver_show_pixbuf (piece->gtkm, priv->shown);
+				}
+			gtk_mapserver_rendered (piece->gtkm);
+		}
+}
+
+/* requests every piece, all counted as pending first: a mounted pack
+ * answers synchronously. A piece is never fetched at a reduced size: its
+ * mapsize, rounded up on each side, would no longer match its mapext,
+ * and thin strips would come stretched */
+static void
+gtk_mapserver_pieces_fetch (GtkMapserver *gtkm)
+{
+	GtkMapserverExtent ext;
+	guint level;
+	gdouble scale_x;
+	gdouble scale_y;
+	guint id;
+	guint i;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	scale_x = (priv->shown_ext.maxx - priv->shown_ext.minx) / gdk_pixbuf_get_width (priv->shown);
+	scale_y = (priv->shown_ext.maxy - priv->shown_ext.miny) / gdk_pixbuf_get_height (priv->shown);
+
+	for (i = 0; i < priv->pieces->len; i++)
+		{
+			GtkMapserverPiece *piece = g_ptr_array_index (priv->pieces, i);
+
+			piece->pending = TRUE;
+		}
+	priv->pieces_pending = priv->pieces->len;
+
+	level = priv->quality_level;
+	while (level > 0 && quality_levels[level].divisor != 1)
+		{
+			level--;
+		}
+
+	for (i = 0; i < priv->pieces->len; i++)
+		{
+			GtkMapserverPiece *piece = g_ptr_array_index (priv->pieces, i);
+
+			ext.minx = priv->shown_ext.minx + (piece->x - piece->margin) * scale_x;
+			ext.maxx = ext.minx + (piece->width + 2 * piece->margin) * scale_x;
+			ext.maxy = priv->shown_ext.maxy - (piece->y - piece->margin) * scale_y;
+			ext.miny = ext.maxy - (piece->height + 2 * piece->margin) * scale_y;
+
+			id = gtk_mapserver_render_full (gtkm, &ext,
+											piece->width + 2 * piece->margin,
+											piece->height + 2 * piece->margin,
+											level,
+											gtkm,
+											GTK_MAPSERVER_PRIORITY_VISIBLE,
+											gtk_mapserver_on_piece_fetched,
+											piece);
+			if (piece->pending)
+				{
+					piece->id = id;
+				}
+		}
+}
+
+static void
+gtk_mapserver_piece_add (GtkMapserver *gtkm, gint x, gint y, gint width, gint height, gint margin)
+{
+	GtkMapserverPiece *piece;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	piece = g_new0 (GtkMapserverPiece, 1);
+	piece->gtkm = gtkm;
+	piece->x = x;
+	piece->y = y;
+	piece->width = width;
+	piece->height = height;
+	piece->margin = margin;
+
+	g_ptr_array_add (priv->pieces, piece);
+}
+
+/* when the view only moved or was resized at the same scale, keeps the
+ * part of the image on screen that is still visible and requests at
+ * most two exposed strips; returns FALSE if a full render is needed */
+static gboolean
+gtk_mapserver_draw_delta (GtkMapserver *gtkm, gint width, gint height)
+{
+	GtkMapserverExtent unsnapped;
+	GdkPixbuf *composed;
+	gint old_width;
+	gint old_height;
+	gdouble scale_x;
+	gdouble scale_y;
+	gdouble old_scale_x;
+	gdouble old_scale_y;
+	gdouble dx;
+	gdouble dy;
+	gint x0;
+	gint y0;
+	gint x1;
+	gint y1;
+	guint strips;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	/* time-series frames differ from each other everywhere */
+	if (priv->shown == NULL || priv->time_values != NULL)
+		{
+			return FALSE;
+		}
+
+	old_width = gdk_pixbuf_get_width (priv->shown);
+	old_height = gdk_pixbuf_get_height (priv->shown);
+
+	scale_x = (priv->ext_cur->maxx - priv->ext_cur->minx) / width;
+	scale_y = (priv->ext_cur->maxy - priv->ext_cur->miny) / height;
+	old_scale_x = (priv->shown_ext.maxx - priv->shown_ext.minx) / old_width;
+	old_scale_y = (priv->shown_ext.maxy - priv->shown_ext.miny) / old_height;
+
+	if (fabs (scale_x - old_scale_x) > old_scale_x * 1e-6
+		|| fabs (scale_y - old_scale_y) > old_scale_y * 1e-6)
+		{
+			return FALSE;
+		}
+
+	/* origin of the new view in the old image, in whole pixels */
+	dx = floor ((priv->ext_cur->minx - priv->shown_ext.minx) / old_scale_x + 0.5);
+	dy = floor ((priv->shown_ext.maxy - priv->ext_cur->maxy) / old_scale_y + 0.5);
+	if (fabs (dx) >= MAX (width, old_width)
+		|| fabs (dy) >= MAX (height, old_height))
+		{
+			return FALSE;
+		}
+
+	/* the overlap, in the new image */
+	x0 = MAX (0, (gint)-dx);
+	y0 = MAX (0, (gint)-dy);
+	x1 = MIN (width, old_width - (gint)dx);
+	y1 = MIN (height, old_height - (gint)dy);
+	if (x0 >= x1 || y0 >= y1)
+		{
+			return FALSE;
+		}
+
+	/* only an L-shaped or straight exposed area is worth it */
+	strips = (y0 > 0) + (y1 < height) + (x0 > 0) + (x1 < width);
+	if (strips > 2)
+		{
+			return FALSE;
+		}
+
+	/* snapping is below half a pixel */
+	unsnapped = *priv->ext_cur;
+	priv->ext_cur->minx = priv->shown_ext.minx + dx * old_scale_x;
+	priv->ext_cur->maxx = priv->ext_cur->minx + width * old_scale_x;
+	priv->ext_cur->maxy = priv->shown_ext.maxy - dy * old_scale_y;
+	priv->ext_cur->miny = priv->ext_cur->maxy - height * old_scale_y;
+	if (!gtk_mapserver_extent_equal (&unsnapped, priv->ext_cur))
+		{
+			gtk_mapserver_context_set_viewport (priv->context, gtkm, priv->ext_cur);
+			g_signal_emit (gtkm, signals[EXTENT_CHANGED], 0);
+		}
+
+	composed = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width, height);
+	gdk_pixbuf_fill (composed, 0xffffffff);
+	gdk_pixbuf_copy_area (priv->shown,
+						  x0 + (gint)dx, y0 + (gint)dy,
+						  x1 - x0, y1 - y0,
+						  composed,
+						  x0, y0);
+
+	gtk_mapserver_set_shown (gtkm, composed, priv->ext_cur);
+	gtk_mapserver_show_pixbuf (gtkm, composed);
+	g_object_unref (composed);
+	priv->pieces_progressive = TRUE;
+
+	if (y0 > 0)
+		{
+			gtk_mapserver_piece_add (gtkm, 0, 0, width, y0, 0);
+		}
+	if (y1 < height)
+		{
+			gtk_mapserver_piece_add (gtkm, 0, y1, width, height - y1, 0);
+		}
+	if (x0 > 0)
+		{
+			gtk_mapserver_piece_add (gtkm, 0, y0, x0, y1 - y0, 0);
+		}
+	if (x1 < width)
+		{
+			gtk_mapserver_piece_add (gtkm, x1, y0, width - x1, y1 - y0, 0);
+		}
+
+	if (priv->pieces->len == 0)
+		{
+			/* shrunk: nothing to request */
+			gtk_mapserver_rendered (gtkm);
+		}
+	else
+		{
+			gtk_mapserver_pieces_fetch (gtkm);
+		}
+
+	return TRUE;
+}
+
+/* splits a full render into a grid of at most split pieces, requested
+ * in parallel so that mapserv renders them on different cores; the
+ * image on screen is replaced once all of them are in */
+static gboolean
+gtk_mapserver_draw_split (GtkMapserver *gtkm, gint width, gint height)
+{
+	GdkPixbuf *composed;
+	guint rows;
+	guint cols;
+	guint r;
+	guint c;
+	gint x;
+	gint y;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	/* a mounted pack renders locally, on one core anyway */
+	if (priv->split < 2 || priv->pack != NULL)
+		{
+			return FALSE;
+		}
+
+	rows = MAX (1, (guint)floor (sqrt (priv->split)));
+	cols = priv->split / rows;
+	rows = MIN (rows, (guint)height);
+	cols = MIN (cols, (guint)width);
+	if (rows * cols < 2)
+		{
+			return FALSE;
+		}
+
+	composed = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width, height);
+	gdk_pixbuf_fill (composed, 0xffffffff);
+	gtk_mapserver_set_shown (gtkm, composed, priv->ext_cur);
+	g_object_unref (composed);
+
+	for (r = 0; r < rows; r++)
+		{
+			y = height * r / rows;
+			for (c = 0; c < cols; c++)
+				{
+					x = width * c / cols;
+					gtk_mapserver_piece_add (gtkm, x, y,
+											 width * (c + 1) / cols - x,
+											 height * (r + 1) / rows - y,
+											 priv->split_overlap);
+				}
+		}
+
+	priv->pieces_progressive = FALSE;
+	gtk_mapserver_pieces_fetch (gtkm);
+
+	return TRUE;
+}
+
+static gboolean
+gtk_mapserver_extent_equal (const GtkMapserverExtent *a, const GtkMapserverExtent *b)
+{
+	return a->minx == b->minx
+		   && a->miny == b->miny
+		   && a->maxx == b->maxx
+		   && a->maxy == b->maxy;
+}
+
+/* removes length entries from index on, releasing their pins */
+static void
+gtk_mapserver_history_remove (GtkMapserver *gtkm, guint index, guint length)
+{
+	GtkMapserverHistoryEntry *entry;
+	guint i;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (length == 0)
+		{
+			return;
+		}
+
+	for (i = index; i < index + length; i++)
+		{
+			entry = g_ptr_array_index (priv->history, i);
+			if (entry->pinned)
+				{
+					gtk_mapserver_context_unpin (priv->context, entry->key);
+				}
+			g_free (entry->key);
+			g_free (entry);
+		}
+	g_ptr_array_remove_range (priv->history, index, length);
+
+	if (priv->history_index >= (gint)(index + length))
+		{
+			priv->history_index -= length;
+		}
+	else if (priv->history_index >= (gint)index)
+		{
+			priv->history_index = (gint)index - 1;
+		}
+}
+
+/* the image on screen is complete: it becomes the current view of the
+ * history, a new one unless it is the view the history is already at */
+static void
+gtk_mapserver_history_record (GtkMapserver *gtkm)
+{
+	GtkMapserverHistoryEntry *entry;
+	gchar *key;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (priv->history_size == 0 || priv->shown == NULL)
+		{
+			return;
+		}
+
+	entry = priv->history_index >= 0
+			? g_ptr_array_index (priv->history, priv->history_index)
+			: NULL;
+	if (entry == NULL || !gtk_mapserver_extent_equal (&entry->ext, &priv->shown_ext))
+		{
+			gtk_mapserver_history_remove (gtkm, priv->history_index + 1,
+										  priv->history->len - (priv->history_index + 1));
+
+			entry = g_new0 (GtkMapserverHistoryEntry, 1);
+			entry->ext = priv->shown_ext;
+			g_ptr_array_add (priv->history, entry);
+			priv->history_index = priv->history->len - 1;
+
+			/* the oldest view slides out */
+			if (priv->history->len > priv->history_size)
+				{
+					gtk_mapserver_history_remove (gtkm, 0, priv->history->len - priv->history_size);
+				}
+		}
+
+	/* an image missing a piece must not come back, a complete one already
+	 * pinned for the view stays */
+	if (priv->pieces_failed)
+		{
+			return;
+		}
+
+	/* frames of a time series and local packs are not worth pinning; the
+	 * key is no url, so a composed image never answers a request for a
+	 * real render, and a view keeps its key, pinned again before the old
+	 * pin goes */
+	key = NULL;
+	if (priv->time_values == NULL && priv->pack == NULL)
+		{
+			key = entry->key != NULL
+				  ? g_strdup (entry->key)
+				  : g_strdup_printf ("gtkmapserver-history:%p:%u", gtkm, ++priv->history_serial);
+		}
+
+	if (key != NULL
+		&& !gtk_mapserver_context_pin (priv->context, key, priv->shown))
+		{
+			g_free (key);
+			key = NULL;
+		}
+	if (entry->pinned)
+		{
+			gtk_mapserver_context_unpin (priv->context, entry->key);
+		}
+	g_free (entry->key);
+
+	entry->key = key;
+	entry->pinned = key != NULL;
+	entry->width = gdk_pixbuf_get_width (priv->shown);
+	entry->height = gdk_pixbuf_get_height (priv->shown);
+}
+
+static void
+gtk_mapserver_rendered (GtkMapserver *gtkm)
+{
+	gtk_mapserver_history_record (gtkm);
+
+	g_signal_emit (gtkm, signals[RENDERED], 0);
+}
+
+/* a view whose pinned image still fits the map is shown from the cache,
+ * at once; the others are drawn as usual */
+static void
+gtk_mapserver_history_go (GtkMapserver *gtkm, gint index)
+{
+	GtkMapserverHistoryEntry *entry;
+	GtkAllocation allocation;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	entry = g_ptr_array_index (priv->history, index);
+	priv->history_index = index;
+
+	*priv->ext_cur = entry->ext;
+
+	if (priv->sevent != NULL)
+		{
+			g_source_destroy (priv->sevent);
+			priv->sevent = NULL;
+		}
+	gtk_mapserver_context_set_viewport (priv->context, gtkm, priv->ext_cur);
+	g_signal_emit (gtkm, signals[EXTENT_CHANGED], 0);
+
+	gtk_widget_get_allocation (GTK_WIDGET (gtkm), &allocation);
+	if (!entry->pinned
+		|| entry->width != MAX (1, allocation.width)
+		|| entry->height != MAX (1, allocation.height))
+		{
+			/* a full render, strips would snap the extent off the entry */
+			gtk_mapserver_set_shown (gtkm, NULL, NULL);
+			gtk_mapserver_draw (gtkm);
+			return;
+		}
+
+	priv->canvas_to_ext_x = (priv->ext_cur->maxx - priv->ext_cur->minx) / allocation.width;
+	priv->canvas_to_ext_y = (priv->ext_cur->maxy - priv->ext_cur->miny) / allocation.height;
+
+	if (priv->fetch_id != 0)
+		{
+			gtk_mapserver_cancel_render (gtkm, priv->fetch_id);
+			priv->fetch_id = 0;
+		}
+	gtk_mapserver_pieces_cancel (gtkm);
+
+	priv->fetch_ext = entry->ext;
+	priv->fetch_width = entry->width;
+	priv->fetch_height = entry->height;
+	priv->fetch_id = gtk_mapserver_context_fetch_full (priv->context,
+													   entry->key,
+													   gtkm,
+													   &entry->ext,
+													   GTK_MAPSERVER_PRIORITY_VISIBLE,
+													   gtk_mapserver_on_fetched,
+													   gtkm);
+}
+
+static void
+gtk_mapserver_show_pixbuf (GtkMapserver *gtkm, GdkPixbuf *pixbuf)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	gdouble x;
+	gdouble y;
+	gdouble scale;
+	gdouble rotation;
+
+	goo_canvas_item_get_simple_transform (priv->img,
+										  &x,
+										  &y,
+										  &scale,
+										  &rotation);
+	goo_canvas_item_set_simple_transform (priv->img,
+										  0,
+										  0,
+										  1,
+										  rotation);
+
+	g_object_set (G_OBJECT (priv->img),
+				  "pixbuf", pixbuf,
+				  NULL);
+}
+
+static void
+gtk_mapserver_event_occurred (GtkMapserver *gtkm)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (priv->sevent != NULL)
+		{
+			g_source_destroy (priv->sevent);
+		}
+	priv->sevent = g_timeout_source_new (priv->redraw_delay);
+	g_source_set_callback (priv->sevent, gtk_mapserver_event_timer, (gpointer)gtkm, NULL);
+	g_source_attach (priv->sevent, NULL);
+	/* the main context keeps it alive until destroyed */
+	g_source_unref (priv->sevent);
+}
+
+static void
+gtk_mapserver_extent_changed (GtkMapserver *gtkm)
+{
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	/* re-rank what is in flight, drop what left the view */
+	gtk_mapserver_context_set_viewport (priv->context, gtkm, priv->ext_cur);
+
+	g_signal_emit (gtkm, signals[EXTENT_CHANGED], 0);
+
+	gtk_mapserver_event_occurred (gtkm);
+}
+
+/* SIGNALS */
+static void
+gtk_mapserver_on_realize (GtkWidget *widget,
+						  gpointer user_data)
+{
+	GtkMapserver *gtkm = (GtkMapserver *)user_data;
+
+	gtk_mapserver_event_occurred (gtkm);
+}
+
+static void
+gtk_mapserver_on_size_allocate (GtkWidget *widget,
+								GdkRectangle *allocation,
+								gpointer user_data)
+{
+	GtkMapserver *gtkm = (GtkMapserver *)user_data;
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	gint old_width;
+	gint old_height;
+
+	old_width = priv->alloc_width;
+	old_height = priv->alloc_height;
+	priv->alloc_width = allocation->width;
+	priv->alloc_height = allocation->height;
+
+	if (!gtk_widget_get_realized (GTK_WIDGET (gtkm))
+		|| (allocation->width == old_width && allocation->height == old_height))
+		{
+			return;
+		}
+
+	/* the extent grows or shrinks with the map at the same scale, fixed
+	 * at the top left corner, so only the exposed strips are fetched */
+	if (priv->ext_cur != NULL
+		&& old_width > 1 && old_height > 1
+		&& allocation->width > 1 && allocation->height > 1)
+		{
+			priv->ext_cur->maxx = priv->ext_cur->minx
+								  + (priv->ext_cur->maxx - priv->ext_cur->minx) / old_width * allocation->width;
+			priv->ext_cur->miny = priv->ext_cur->maxy
+								  - (priv->ext_cur->maxy - priv->ext_cur->miny) / old_height * allocation->height;
+
+			gtk_mapserver_extent_changed (gtkm);
+			return;
+		}
+
+	gtk_mapserver_event_occurred (gtkm);
+}
+
+static void
+gtk_mapserver_center_map (GtkMapserver *gtkm)
+{
+	GtkAllocation allocation;
+	GooCanvasBounds bounds;
+
+	gdouble x;
+	gdouble y;
+	gdouble scale;
+	gdouble rotation;
+
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	gtk_widget_get_allocation (GTK_WIDGET (gtkm), &allocation);
+
+	goo_canvas_item_get_bounds (priv->img, &bounds);
+
+	goo_canvas_item_get_simple_transform (priv->img,
+										  &x,
+										  &y,
+										  &scale,
+										  &rotation);
+
+	goo_canvas_item_set_simple_transform (priv->img,
+										  ((gdouble)allocation.width - (bounds.x2 - bounds.x1)) / 2,
+										  ((gdouble)allocation.height - (bounds.y2 - bounds.y1)) / 2,
+										  scale,
+										  rotation);
+}
+
+static gboolean
+gtk_mapserver_on_key_release_event (GooCanvasItem *item,
+									GooCanvasItem *target_item,
+									GdkEventKey *event,
+									gpointer user_data)
+{
+	GtkMapserver *gtkm = (GtkMapserver *)user_data;
+	GtkMapserverPrivate *priv = GTK_MAPSERVER_GET_PRIVATE (gtkm);
+
+	if (!gtk_widget_get_realized (GTK_WIDGET (gtkm)))
+		{
+			return FALSE;
+		}
+
+	switch (event->keyval)
+		{
+			case GDK_KEY_0:
+			case GDK_KEY_KP_0:
+				{
+					gdouble x;
+					gdouble y;
+					gdouble scale;
+					gdouble rotation;
+
+					goo_canvas_item_get_simple_transform (priv->img,
+														  &x,
+														  &y,
+														  &scale,
+														  &rotation);
+					goo_canvas_item_set_simple_transform (priv->img,
+														  x,
+														  y,
+														  1,
+														  rotation);
+					gtk_mapserver_center_map (gtkm);
+
+					g_free (priv->ext_cur);
+					priv->ext_cur = g_memdup (priv->ext, sizeof (GtkMapserverExtent));
+
+					gtk_mapserver_extent_changed (gtkm);
+
+					return TRUE;
+				}
+
+			case GDK_KEY_plus:
 			case GDK_KEY_KP_Add:
 				{
 					gdouble x;
@@ -673,7 +2619,7 @@ gtk_mapserver_on_key_release_event (GooCanvasItem *item,
 					priv->ext_cur->maxx -= ext_scale_x;
 					priv->ext_cur->maxy -= ext_scale_y;
 
-					gtk_mapserver_event_occurred (gtkm);
+					gtk_mapserver_extent_changed (gtkm);
 
 					return TRUE;
 				}
@@ -708,10 +2654,25 @@ gtk_mapserver_on_key_release_event (GooCanvasItem *item,
 					priv->ext_cur->maxx += ext_scale_x;
 					priv->ext_cur->maxy += ext_scale_y;
 
-					gtk_mapserver_event_occurred (gtkm);
+					gtk_mapserver_extent_changed (gtkm);
 
 					return TRUE;
 				}
+
+			case GDK_KEY_BackSpace:
+			case GDK_KEY_Back:
+				return gtk_mapserver_go_back (gtkm);
+
+			case GDK_KEY_Forward:
+				return gtk_mapserver_go_forward (gtkm);
+
+			case GDK_KEY_Left:
+				return (event->state & GDK_MOD1_MASK) != 0
+					   && gtk_mapserver_go_back (gtkm);
+
+			case GDK_KEY_Right:
+				return (event->state & GDK_MOD1_MASK) != 0
+					   && gtk_mapserver_go_forward (gtkm);
 		}
 
 	return FALSE;
@@ -762,7 +2723,7 @@ gtk_mapserver_on_button_release_event (GtkWidget *widget,
 	priv->ext_cur->maxx -= (x * priv->canvas_to_ext_x);
 	priv->ext_cur->maxy += (y * priv->canvas_to_ext_y);
 
-	gtk_mapserver_event_occurred (gtkm);
+	gtk_mapserver_extent_changed (gtkm);
 }
 
 static gboolean
@@ -31,6 +31,8 @@
 #include <goocanvas.h>
 #include <libsoup/soup.h>
 
+#include "gtkmapservercontext.h"
+
 
 G_BEGIN_DECLS
 
@@ -66,18 +68,42 @@ SoupMessage *gtk_mapserver_get_soup_message (GtkMapserver *gtkm,
 
 GdkPixbuf *gtk_mapserver_get_gdk_pixbuf (GtkMapserver *gtkm, const gchar *url);
 
-typedef struct
-	{
-		gdouble minx;
-		gdouble miny;
-		gdouble maxx;
-		gdouble maxy;
-	} GtkMapserverExtent;
-
 GtkMapserverExtent *gtk_mapserver_get_extent (GtkMapserver *gtkm, const gchar *url);
 
 void gtk_mapserver_set_home (GtkMapserver *gtkm, const gchar *url, GtkMapserverExtent *ext);
 
+gboolean gtk_mapserver_get_home_extent (GtkMapserver *gtkm, GtkMapserverExtent *ext);
+gboolean gtk_mapserver_get_current_extent (GtkMapserver *gtkm, GtkMapserverExtent *ext);
+void gtk_mapserver_set_current_extent (GtkMapserver *gtkm, const GtkMapserverExtent *ext);
+
+gboolean gtk_mapserver_can_go_back (GtkMapserver *gtkm);
+gboolean gtk_mapserver_can_go_forward (GtkMapserver *gtkm);
+gboolean gtk_mapserver_go_back (GtkMapserver *gtkm);
+gboolean gtk_mapserver_go_forward (GtkMapserver *gtkm);
+
+gchar *gtk_mapserver_get_url (GtkMapserver *gtkm,
+							  const GtkMapserverExtent *ext,
+							  gint width,
+							  gint height);
+
+guint gtk_mapserver_render (GtkMapserver *gtkm,
+							const GtkMapserverExtent *ext,
+							gint width,
+							gint height,
+							GtkMapserverContextFunc func,
+							gpointer user_data);
+void gtk_mapserver_cancel_render (GtkMapserver *gtkm, guint id);
+
+void gtk_mapserver_set_time_values (GtkMapserver *gtkm, const gchar *param, const gchar * const *values);
+void gtk_mapserver_set_time_index (GtkMapserver *gtkm, guint index);
+guint gtk_mapserver_get_time_index (GtkMapserver *gtkm);
+
+void gtk_mapserver_play (GtkMapserver *gtkm, gdouble fps);
+void gtk_mapserver_stop (GtkMapserver *gtkm);
+
+gboolean gtk_mapserver_mount_pack (GtkMapserver *gtkm, const gchar *filename, GError **error);
+void gtk_mapserver_unmount_pack (GtkMapserver *gtkm);
+
 
 G_END_DECLS
 
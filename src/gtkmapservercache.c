@@ -0,0 +1,314 @@
+/*
+ *  gtkmapservercache.c
+ *
+ *  Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This file is part of libgtkmapserver.
+ *
+ *  libgtkmapserver is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libgtkmapserver is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libgtkmapserver; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include <config.h>
+#endif
+
+#include "gtkmapservercache.h"
+
+typedef struct
+	{
+		gpointer value;
+		gsize size;
+		GList *link;
+		guint pins;
+	} GtkMapserverCacheEntry;
+
+typedef struct
+	{
+		GHashTable *table;
+		GQueue *lru;
+		GDestroyNotify value_free;
+
+		gsize size;
+		gsize used;
+		guint64 hits;
+		guint64 misses;
+	} GtkMapserverCacheTier;
+
+struct _GtkMapserverCache
+	{
+		GtkMapserverCacheTier l1;
+		GtkMapserverCacheTier l2;
+	};
+
+static void
+gtk_mapserver_cache_tier_init (GtkMapserverCacheTier *tier, gsize size, GDestroyNotify value_free)
+{
+	tier->table = g_hash_table_new (g_str_hash, g_str_equal);
+	tier->lru = g_queue_new ();
+	tier->value_free = value_free;
+
+	tier->size = size;
+	tier->used = 0;
+	tier->hits = 0;
+	tier->misses = 0;
+}
+
+static void
+gtk_mapserver_cache_tier_remove (GtkMapserverCacheTier *tier, GList *link)
+{
+	GtkMapserverCacheEntry *entry;
+	gchar *key;
+
+	key = (gchar *)link->data;
+	entry = g_hash_table_lookup (tier->table, key);
+
+	g_hash_table_remove (tier->table, key);
+	g_queue_delete_link (tier->lru, link);
+
+	tier->used -= entry->size;
+	tier->value_free (entry->value);
+	g_free (entry);
+	g_free (key);
+}
+
+/* pinned entries are skipped, even if that leaves the tier over budget */
+static void
+gtk_mapserver_cache_tier_trim (GtkMapserverCacheTier *tier)
+{
+	GtkMapserverCacheEntry *entry;
+	GList *link;
+	GList *prev;
+
+	link = tier->lru->tail;
+	while (tier->used > tier->size
+		   && link != NULL)
+		{
+			prev = link->prev;
+			entry = g_hash_table_lookup (tier->table, link->data);
+			if (entry->pins == 0)
+				{
+					gtk_mapserver_cache_tier_remove (tier, link);
+				}
+			link = prev;
+		}
+}
+
+static void
+gtk_mapserver_cache_tier_clear (GtkMapserverCacheTier *tier)
+{
+	while (tier->lru->tail != NULL)
+		{
+			gtk_mapserver_cache_tier_remove (tier, tier->lru->tail);
+		}
+	g_hash_table_destroy (tier->table);
+	g_queue_free (tier->lru);
+}
+
+static gpointer
+gtk_mapserver_cache_tier_lookup (GtkMapserverCacheTier *tier, const gchar *key)
+{
+	GtkMapserverCacheEntry *entry;
+
+	entry = g_hash_table_lookup (tier->table, key);
+	if (entry == NULL)
+		{
+			tier->misses++;
+			return NULL;
+		}
+
+	tier->hits++;
+	g_queue_unlink (tier->lru, entry->link);
+	g_queue_push_head_link (tier->lru, entry->link);
+
+	return entry->value;
+}
+
+/* pins are added to those of the entry replaced; a pinned entry is kept
+ * whatever its size, and is not what the trim evicts */
+static void
+gtk_mapserver_cache_tier_insert (GtkMapserverCacheTier *tier, const gchar *key, gpointer value, gsize size, guint pins)
+{
+	GtkMapserverCacheEntry *entry;
+	gchar *_key;
+
+	entry = g_hash_table_lookup (tier->table, key);
+	if (entry != NULL)
+		{
+			pins += entry->pins;
+			gtk_mapserver_cache_tier_remove (tier, entry->link);
+		}
+
+	if (pins == 0 && size > tier->size)
+		{
+			tier->value_free (value);
+			return;
+		}
+
+	_key = g_strdup (key);
+
+	entry = g_new0 (GtkMapserverCacheEntry, 1);
+	entry->value = value;
+	entry->size = size;
+	entry->pins = pins;
+
+	g_queue_push_head (tier->lru, _key);
+	entry->link = tier->lru->head;
+
+	g_hash_table_insert (tier->table, _key, entry);
+	tier->used += size;
+
+	gtk_mapserver_cache_tier_trim (tier);
+}
+
+GtkMapserverCache
+*gtk_mapserver_cache_new (gsize l1_size, gsize l2_size)
+{
+	GtkMapserverCache *cache;
+
+	cache = g_new0 (GtkMapserverCache, 1);
+
+	gtk_mapserver_cache_tier_init (&cache->l1, l1_size, g_object_unref);
+	gtk_mapserver_cache_tier_init (&cache->l2, l2_size, (GDestroyNotify)g_bytes_unref);
+
+	return cache;
+}
+
+void
+gtk_mapserver_cache_free (GtkMapserverCache *cache)
+{
+	gtk_mapserver_cache_tier_clear (&cache->l1);
+	gtk_mapserver_cache_tier_clear (&cache->l2);
+	g_free (cache);
+}
+
+void
+gtk_mapserver_cache_set_l1_size (GtkMapserverCache *cache, gsize size)
+{
+	cache->l1.size = size;
+	gtk_mapserver_cache_tier_trim (&cache->l1);
+}
+
+gsize
+gtk_mapserver_cache_get_l1_size (GtkMapserverCache *cache)
+{
+	return cache->l1.size;
+}
+
+void
+gtk_mapserver_cache_set_l2_size (GtkMapserverCache *cache, gsize size)
+{
+	cache->l2.size = size;
+	gtk_mapserver_cache_tier_trim (&cache->l2);
+}
+
+gsize
+gtk_mapserver_cache_get_l2_size (GtkMapserverCache *cache)
+{
+	return cache->l2.size;
+}
+
+/* Returns: (transfer none): the decoded image, or NULL on L1 miss. */
+GdkPixbuf
+*gtk_mapserver_cache_lookup_pixbuf (GtkMapserverCache *cache, const gchar *key)
+{
+	return (GdkPixbuf *)gtk_mapserver_cache_tier_lookup (&cache->l1, key);
+}
+
+/* Returns: (transfer none): the encoded body, or NULL on L2 miss. */
+GBytes
+*gtk_mapserver_cache_lookup_bytes (GtkMapserverCache *cache, const gchar *key)
+{
+	return (GBytes *)gtk_mapserver_cache_tier_lookup (&cache->l2, key);
+}
+
+void
+gtk_mapserver_cache_insert (GtkMapserverCache *cache,
+							const gchar *key,
+							GBytes *bytes,
+							GdkPixbuf *pixbuf)
+{
+	if (bytes != NULL)
+		{
+			gtk_mapserver_cache_tier_insert (&cache->l2, key,
+											 g_bytes_ref (bytes),
+											 g_bytes_get_size (bytes),
+											 0);
+		}
+	if (pixbuf != NULL)
+		{
+			gtk_mapserver_cache_tier_insert (&cache->l1, key,
+											 g_object_ref (pixbuf),
+											 (gsize)gdk_pixbuf_get_rowstride (pixbuf) * gdk_pixbuf_get_height (pixbuf),
+											 0);
+		}
+}
+
+/* stores @pixbuf under @key unless L1 already holds it, and keeps the
+ * entry until unpinned as many times, over the budget if need be; FALSE
+ * if there is no @pixbuf and L1 does not hold @key */
+gboolean
+gtk_mapserver_cache_pin (GtkMapserverCache *cache, const gchar *key, GdkPixbuf *pixbuf)
+{
+	GtkMapserverCacheEntry *entry;
+
+	entry = g_hash_table_lookup (cache->l1.table, key);
+	if (pixbuf != NULL
+		&& (entry == NULL || entry->value != pixbuf))
+		{
+			gtk_mapserver_cache_tier_insert (&cache->l1, key,
+											 g_object_ref (pixbuf),
+											 (gsize)gdk_pixbuf_get_rowstride (pixbuf) * gdk_pixbuf_get_height (pixbuf),
+											 1);
+			return TRUE;
+		}
+	if (entry == NULL)
+		{
+			return FALSE;
+		}
+
+	entry->pins++;
+
+	return TRUE;
+}
+
+void
+gtk_mapserver_cache_unpin (GtkMapserverCache *cache, const gchar *key)
+{
+	GtkMapserverCacheEntry *entry;
+
+	entry = g_hash_table_lookup (cache->l1.table, key);
+	if (entry == NULL || entry->pins == 0)
+		{
+			return;
+		}
+
+	entry->pins--;
+	gtk_mapserver_cache_tier_trim (&cache->l1);
+}
+
+void
+gtk_mapserver_cache_get_stats (GtkMapserverCache *cache, GtkMapserverCacheStats *stats)
+{
+	stats->l1_hits = cache->l1.hits;
+	stats->l1_misses = cache->l1.misses;
+	stats->l1_used = cache->l1.used;
+	stats->l1_size = cache->l1.size;
+
+	stats->l2_hits = cache->l2.hits;
+	stats->l2_misses = cache->l2.misses;
+	stats->l2_used = cache->l2.used;
+	stats->l2_size = cache->l2.size;
+}
@@ -0,0 +1,66 @@
+/*
+ *  gtkmapservercache.h
+ *
+ *  Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This file is part of libgtkmapserver.
+ *
+ *  libgtkmapserver is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libgtkmapserver is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libgtkmapserver; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __GTK_MAPSERVER_CACHE_H__
+#define __GTK_MAPSERVER_CACHE_H__
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "gtkmapservercontext.h"
+
+
+G_BEGIN_DECLS
+
+
+/* Two tiers keyed by url: L1 holds decoded images ready to paint, L2 the
+ * encoded response bodies, roughly ten times smaller. Each tier is an LRU
+ * with its own byte budget; pinned L1 entries are never evicted. Not
+ * thread safe: main loop only. */
+typedef struct _GtkMapserverCache GtkMapserverCache;
+
+GtkMapserverCache *gtk_mapserver_cache_new (gsize l1_size, gsize l2_size);
+void gtk_mapserver_cache_free (GtkMapserverCache *cache);
+
+void gtk_mapserver_cache_set_l1_size (GtkMapserverCache *cache, gsize size);
+gsize gtk_mapserver_cache_get_l1_size (GtkMapserverCache *cache);
+void gtk_mapserver_cache_set_l2_size (GtkMapserverCache *cache, gsize size);
+gsize gtk_mapserver_cache_get_l2_size (GtkMapserverCache *cache);
+
+GdkPixbuf *gtk_mapserver_cache_lookup_pixbuf (GtkMapserverCache *cache, const gchar *key);
+GBytes *gtk_mapserver_cache_lookup_bytes (GtkMapserverCache *cache, const gchar *key);
+
+void gtk_mapserver_cache_insert (GtkMapserverCache *cache,
+								 const gchar *key,
+								 GBytes *bytes,
+								 GdkPixbuf *pixbuf);
+
+gboolean gtk_mapserver_cache_pin (GtkMapserverCache *cache, const gchar *key, GdkPixbuf *pixbuf);
+void gtk_mapserver_cache_unpin (GtkMapserverCache *cache, const gchar *key);
+
+void gtk_mapserver_cache_get_stats (GtkMapserverCache *cache, GtkMapserverCacheStats *stats);
+
+
+G_END_DECLS
+
+#endif /* __GTK_MAPSERVER_CACHE_H__ */
@@ -0,0 +1,1018 @@
+/*
+ *  gtkmapservercontext.c
+ *
+ *  Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This file is part of libgtkmapserver.
+ *
+ *  libgtkmapserver is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libgtkmapserver is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libgtkmapserver; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include <config.h>
+#endif
+
+#include "gtkmapservercontext.h"
+#include "gtkmapservercache.h"
+
+enum
+{
+	PROP_0,
+	PROP_MAX_CONNECTIONS,
+	PROP_L1_SIZE,
+	PROP_L2_SIZE
+};
+
+static void gtk_mapserver_context_class_init (GtkMapserverContextClass *klass);
+static void gtk_mapserver_context_init (GtkMapserverContext *ctx);
+
+static void gtk_mapserver_context_set_property (GObject *object,
+                               guint property_id,
+                               const GValue *value,
+                               GParamSpec *pspec);
+static void gtk_mapserver_context_get_property (GObject *object,
+                               guint property_id,
+                               GValue *value,
+                               GParamSpec *pspec);
+
+static void gtk_mapserver_context_finalize (GObject *object);
+
+static void gtk_mapserver_context_job_run (gpointer data, gpointer user_data);
+static void gtk_mapserver_context_dispatch (GtkMapserverContext *ctx);
+
+#define GTK_MAPSERVER_CONTEXT_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), GTK_TYPE_MAPSERVER_CONTEXT, GtkMapserverContextPrivate))
+
+/* requests run in this order: visible and under the viewport centre,
+ * then visible by distance from the centre, then prefetch */
+enum
+{
+	RANK_CENTER,
+	RANK_VISIBLE,
+	RANK_PREFETCH
+};
+
+typedef struct
+	{
+		guint id;
+		GtkMapserverContextFunc func;
+		gpointer user_data;
+
+		gpointer owner;
+		GtkMapserverExtent ext;
+		gboolean has_ext;
+		GtkMapserverPriority priority;
+
+		guint rank;
+		gdouble distance;
+	} GtkMapserverContextWaiter;
+
+typedef struct
+	{
+		GtkMapserverContext *ctx;
+		gchar *url;
+		GList *waiters;
+		GBytes *bytes;
+		GdkPixbuf *pixbuf;
+		gboolean running;
+		gboolean local;
+
+		guint rank;
+		gdouble distance;
+
+		/* under msg_lock */
+		SoupMessage *msg;
+		gboolean abandoned;
+	} GtkMapserverContextJob;
+
+typedef struct _GtkMapserverContextPrivate GtkMapserverContextPrivate;
+struct _GtkMapserverContextPrivate
+	{
+		SoupSession *soup_session;
+		GThreadPool *pool;
+		GThreadPool *decode_pool;
+
+		GQueue *pending;
+		GHashTable *jobs;
+		GHashTable *waiters;
+		guint next_id;
+		guint running;
+		guint max_connections;
+		GHashTable *viewports;
+		GMutex msg_lock;
+
+		GtkMapserverCache *cache;
+
+		/* averages of the completed requests, under link_lock */
+		GMutex link_lock;
+		guint link_samples;
+		gdouble link_latency;
+		gdouble link_bytes;
+		gdouble link_transfer;
+	};
+
+G_DEFINE_TYPE (GtkMapserverContext, gtk_mapserver_context, G_TYPE_OBJECT)
+
+#define MAX_CONNECTIONS 6
+#define L1_SIZE (32 * 1024 * 1024)
+#define L2_SIZE (128 * 1024 * 1024)
+/* weight of the newest request in the link averages */
+#define LINK_WEIGHT 0.3
+
+static void
+gtk_mapserver_context_class_init (GtkMapserverContextClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	g_type_class_add_private (object_class, sizeof (GtkMapserverContextPrivate));
+
+	object_class->set_property = gtk_mapserver_context_set_property;
+	object_class->get_property = gtk_mapserver_context_get_property;
+	object_class->finalize = gtk_mapserver_context_finalize;
+
+	g_object_class_install_property (object_class, PROP_MAX_CONNECTIONS,
+									 g_param_spec_uint ("max-connections",
+														"Max connections",
+														"Maximum number of requests in flight for the whole context",
+														1, G_MAXUINT, MAX_CONNECTIONS,
+														G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class, PROP_L1_SIZE,
+									 g_param_spec_uint64 ("l1-size",
+														  "L1 size",
+														  "Bytes of decoded images kept ready to paint",
+														  0, G_MAXUINT64, L1_SIZE,
+														  G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class, PROP_L2_SIZE,
+									 g_param_spec_uint64 ("l2-size",
+														  "L2 size",
+														  "Bytes of encoded images kept to be decoded again",
+														  0, G_MAXUINT64, L2_SIZE,
+														  G_PARAM_READWRITE));
+}
+
+static void
+gtk_mapserver_context_init (GtkMapserverContext *ctx)
+{
+	GtkMapserverContextPrivate *priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx);
+
+	priv->max_connections = MAX_CONNECTIONS;
+
+	priv->soup_session = soup_session_sync_new_with_options (SOUP_SESSION_SSL_CA_FILE, NULL,
+															 SOUP_SESSION_ADD_FEATURE_BY_TYPE, SOUP_TYPE_CONTENT_DECODER,
+															 SOUP_SESSION_ADD_FEATURE_BY_TYPE, SOUP_TYPE_COOKIE_JAR,
+															 SOUP_SESSION_USER_AGENT, "get ",
+															 SOUP_SESSION_ACCEPT_LANGUAGE_AUTO, TRUE,
+															 SOUP_SESSION_USE_NTLM, FALSE,
+															 SOUP_SESSION_MAX_CONNS, priv->max_connections,
+															 SOUP_SESSION_MAX_CONNS_PER_HOST, priv->max_connections,
+															 NULL);
+
+	/* fetch and decode run here, never on the main loop */
+	priv->pool = g_thread_pool_new (gtk_mapserver_context_job_run, ctx, priv->max_connections, FALSE, NULL);
+	/* promotions from L2 only decode, they do not wait for a connection */
+	priv->decode_pool = g_thread_pool_new (gtk_mapserver_context_job_run, ctx, g_get_num_processors (), FALSE, NULL);
+
+	priv->pending = g_queue_new ();
+	priv->jobs = g_hash_table_new (g_str_hash, g_str_equal);
+	priv->waiters = g_hash_table_new (g_direct_hash, g_direct_equal);
+	priv->next_id = 0;
+	priv->running = 0;
+	priv->viewports = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+	g_mutex_init (&priv->msg_lock);
+
+	g_mutex_init (&priv->link_lock);
+	priv->link_samples = 0;
+	priv->link_latency = 0.0;
+	priv->link_bytes = 0.0;
+	priv->link_transfer = 0.0;
+
+	priv->cache = gtk_mapserver_cache_new (L1_SIZE, L2_SIZE);
+}
+
+/**
+ * gtk_mapserver_context_new:
+ *
+ * Returns: the new created #GtkMapserverContext object.
+ */
+GtkMapserverContext
+*gtk_mapserver_context_new ()
+{
+	GtkMapserverContext *ctx = GTK_MAPSERVER_CONTEXT (g_object_new (gtk_mapserver_context_get_type (), NULL));
+
+	return ctx;
+}
+
+/**
+ * gtk_mapserver_context_get_default:
+ *
+ * Returns: (transfer none): the context shared by every #GtkMapserver
+ * that was not given one explicitly.
+ */
+GtkMapserverContext
+*gtk_mapserver_context_get_default ()
+{
+	static GtkMapserverContext *ctx = NULL;
+
+	if (ctx == NULL)
+		{
+			ctx = gtk_mapserver_context_new ();
+		}
+
+	return ctx;
+}
+
+/**
+ * gtk_mapserver_context_get_soup_session:
+ * @ctx:
+ *
+ * Returns: (transfer none): the #SoupSession shared by the context.
+ */
+SoupSession
+*gtk_mapserver_context_get_soup_session (GtkMapserverContext *ctx)
+{
+	g_return_val_if_fail (GTK_IS_MAPSERVER_CONTEXT (ctx), NULL);
+
+	return GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx)->soup_session;
+}
+
+/**
+ * gtk_mapserver_context_get_cache_stats:
+ * @ctx:
+ * @stats: (out): where to store budgets, usage and hits of both tiers.
+ */
+void
+gtk_mapserver_context_get_cache_stats (GtkMapserverContext *ctx, GtkMapserverCacheStats *stats)
+{
+	g_return_if_fail (GTK_IS_MAPSERVER_CONTEXT (ctx));
+	g_return_if_fail (stats != NULL);
+
+	gtk_mapserver_cache_get_stats (GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx)->cache, stats);
+}
+
+/**
+ * gtk_mapserver_context_pin:
+ * @ctx:
+ * @url:
+ * @pixbuf: (allow-none): the image to keep for @url; NULL pins what the
+ * cache already holds.
+ *
+ * Keeps the decoded image of @url in the cache, whatever its budget,
+ * until gtk_mapserver_context_unpin(). Pins are counted.
+ *
+ * Returns: FALSE if nothing was pinned.
+ */
+gboolean
+gtk_mapserver_context_pin (GtkMapserverContext *ctx, const gchar *url, GdkPixbuf *pixbuf)
+{
+	g_return_val_if_fail (GTK_IS_MAPSERVER_CONTEXT (ctx), FALSE);
+	g_return_val_if_fail (url != NULL, FALSE);
+
+	return gtk_mapserver_cache_pin (GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx)->cache, url, pixbuf);
+}
+
+/**
+ * gtk_mapserver_context_unpin:
+ * @ctx:
+ * @url:
+ *
+ * Releases a pin taken by gtk_mapserver_context_pin(); the image is
+ * evicted as usual once no pin is left.
+ */
+void
+gtk_mapserver_context_unpin (GtkMapserverContext *ctx, const gchar *url)
+{
+	g_return_if_fail (GTK_IS_MAPSERVER_CONTEXT (ctx));
+	g_return_if_fail (url != NULL);
+
+	gtk_mapserver_cache_unpin (GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx)->cache, url);
+}
+
+/**
+ * gtk_mapserver_context_get_link_estimate:
+ * @ctx:
+ * @latency: (out) (allow-none): seconds from request to response headers.
+ * @throughput: (out) (allow-none): bytes per second of response bodies.
+ *
+ * Both are moving averages over the requests completed so far.
+ *
+ * Returns: FALSE if no request completed yet.
+ */
+gboolean
+gtk_mapserver_context_get_link_estimate (GtkMapserverContext *ctx, gdouble *latency, gdouble *throughput)
+{
+	GtkMapserverContextPrivate *priv;
+	gboolean ret;
+
+	g_return_val_if_fail (GTK_IS_MAPSERVER_CONTEXT (ctx), FALSE);
+
+	priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx);
+
+	g_mutex_lock (&priv->link_lock);
+	ret = priv->link_samples > 0;
+	if (latency != NULL)
+		{
+			*latency = priv->link_latency;
+		}
+	if (throughput != NULL)
+		{
+			/* a body read in no measurable time says nothing of the link */
+			*throughput = priv->link_transfer > 0.0 ? priv->link_bytes / priv->link_transfer : G_MAXDOUBLE;
+		}
+	g_mutex_unlock (&priv->link_lock);
+
+	return ret;
+}
+
+static void
+gtk_mapserver_context_link_add (GtkMapserverContext *ctx, gdouble latency, gsize bytes, gdouble transfer)
+{
+	GtkMapserverContextPrivate *priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx);
+
+	g_mutex_lock (&priv->link_lock);
+	if (priv->link_samples == 0)
+		{
+			priv->link_latency = latency;
+			priv->link_bytes = bytes;
+			priv->link_transfer = transfer;
+		}
+	else
+		{
+			priv->link_latency += LINK_WEIGHT * (latency - priv->link_latency);
+			priv->link_bytes += LINK_WEIGHT * (bytes - priv->link_bytes);
+			priv->link_transfer += LINK_WEIGHT * (transfer - priv->link_transfer);
+		}
+	priv->link_samples++;
+	g_mutex_unlock (&priv->link_lock);
+}
+
+static void
+gtk_mapserver_context_on_got_headers (SoupMessage *msg, gpointer user_data)
+{
+	*(gint64 *)user_data = g_get_monotonic_time ();
+}
+
+static void
+gtk_mapserver_context_job_free (GtkMapserverContextJob *job)
+{
+	g_free (job->url);
+	if (job->bytes != NULL)
+		{
+			g_bytes_unref (job->bytes);
+		}
+	if (job->pixbuf != NULL)
+		{
+			g_object_unref (job->pixbuf);
+		}
+	g_list_free_full (job->waiters, g_free);
+	g_free (job);
+}
+
+static gboolean
+gtk_mapserver_context_job_done (gpointer data)
+{
+	GtkMapserverContextJob *job = (GtkMapserverContextJob *)data;
+	GtkMapserverContext *ctx = job->ctx;
+	GtkMapserverContextPrivate *priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx);
+
+	GList *l;
+
+	if (!job->local)
+		{
+			priv->running--;
+		}
+	if (g_hash_table_lookup (priv->jobs, job->url) == job)
+		{
+			g_hash_table_remove (priv->jobs, job->url);
+		}
+
+	if (job->bytes != NULL)
+		{
+			gtk_mapserver_cache_insert (priv->cache, job->url, job->bytes, job->pixbuf);
+		}
+
+	/* a waiter may cancel the ones after it: they are only marked */
+	for (l = job->waiters; l != NULL; l = l->next)
+		{
+			GtkMapserverContextWaiter *waiter = (GtkMapserverContextWaiter *)l->data;
+
+			if (waiter->func != NULL)
+				{
+					g_hash_table_remove (priv->waiters, GUINT_TO_POINTER (waiter->id));
+					waiter->func (ctx, job->url, job->pixbuf, waiter->user_data);
+				}
+		}
+
+	gtk_mapserver_context_job_free (job);
+
+	gtk_mapserver_context_dispatch (ctx);
+	g_object_unref (ctx);
+
+	return FALSE;
+}
+
+static void
+gtk_mapserver_context_job_run (gpointer data, gpointer user_data)
+{
+	GtkMapserverContextJob *job = (GtkMapserverContextJob *)data;
+	GtkMapserverContextPrivate *priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (job->ctx);
+
+	SoupMessage *msg;
+	GdkPixbufLoader *pxb_loader;
+	GError *error;
+	gint64 started;
+	gint64 headers;
+
+	if (job->bytes == NULL)
+		{
+			msg = soup_message_new (SOUP_METHOD_GET, job->url);
+			if (SOUP_IS_MESSAGE (msg))
+				{
+					soup_message_set_flags (msg, SOUP_MESSAGE_NO_REDIRECT);
+
+					g_mutex_lock (&priv->msg_lock);
+					if (job->abandoned)
+						{
+							soup_message_set_status (msg, SOUP_STATUS_CANCELLED);
+						}
+					else
+						{
+							job->msg = msg;
+						}
+					g_mutex_unlock (&priv->msg_lock);
+
+					if (job->msg != NULL)
+						{
+							headers = 0;
+							g_signal_connect (msg, "got-headers",
+											  G_CALLBACK (gtk_mapserver_context_on_got_headers), &headers);
+
+							started = g_get_monotonic_time ();
+							soup_session_send_message (priv->soup_session, msg);
+
+							if (headers != 0 && SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+								{
+									gtk_mapserver_context_link_add (job->ctx,
+																	(gdouble)(headers - started) / G_USEC_PER_SEC,
+																	msg->response_body->length,
+																	(gdouble)(g_get_monotonic_time () - headers) / G_USEC_PER_SEC);
+								}
+
+							g_mutex_lock (&priv->msg_lock);
+							job->msg = NULL;
+							g_mutex_unlock (&priv->msg_lock);
+						}
+				}
+
+			if (SOUP_IS_MESSAGE (msg) && msg->status_code == SOUP_STATUS_CANCELLED)
+				{
+					/* nobody waits for it anymore */
+				}
+			else if (!SOUP_IS_MESSAGE (msg) || !SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+				{
+					g_warning ("Error on retrieving url: %s.", job->url);
+				}
+			else
+				{
+					job->bytes = g_bytes_new (msg->response_body->data, msg->response_body->length);
+				}
+
+			if (msg != NULL)
+				{
+					g_object_unref (msg);
+				}
+		}
+
+	if (job->bytes != NULL)
+		{
+			gconstpointer data;
+			gsize length;
+
+			data = g_bytes_get_data (job->bytes, &length);
+
+			error = NULL;
+			pxb_loader = gdk_pixbuf_loader_new ();
+			if (gdk_pixbuf_loader_write (pxb_loader, data, length, &error)
+				&& gdk_pixbuf_loader_close (pxb_loader, &error))
+				{
+					job->pixbuf = g_object_ref (gdk_pixbuf_loader_get_pixbuf (pxb_loader));
+				}
+			else
+				{
+					g_warning ("Error on retrieving map image: %s.",
+							   error != NULL && error->message != NULL ? error->message : "no details");
+					g_clear_error (&error);
+					gdk_pixbuf_loader_close (pxb_loader, NULL);
+
+					/* not worth caching */
+					g_bytes_unref (job->bytes);
+					job->bytes = NULL;
+				}
+			g_object_unref (pxb_loader);
+		}
+
+	g_main_context_invoke (NULL, gtk_mapserver_context_job_done, job);
+}
+
+static gboolean
+gtk_mapserver_context_extent_intersects (const GtkMapserverExtent *a, const GtkMapserverExtent *b)
+{
+	return a->minx < b->maxx && a->maxx > b->minx
+		   && a->miny < b->maxy && a->maxy > b->miny;
+}
+
+static void
+gtk_mapserver_context_waiter_rank (GtkMapserverContext *ctx, GtkMapserverContextWaiter *waiter)
+{
+	GtkMapserverExtent *viewport;
+
+	gdouble center_x;
+	gdouble center_y;
+	gdouble dx;
+	gdouble dy;
+	gdouble size;
+
+	GtkMapserverContextPrivate *priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx);
+
+	waiter->distance = 0.0;
+
+	if (waiter->priority == GTK_MAPSERVER_PRIORITY_PREFETCH)
+		{
+			waiter->rank = RANK_PREFETCH;
+			return;
+		}
+
+	viewport = waiter->owner != NULL ? g_hash_table_lookup (priv->viewports, waiter->owner) : NULL;
+	if (viewport == NULL || !waiter->has_ext)
+		{
+			waiter->rank = RANK_VISIBLE;
+			return;
+		}
+
+	center_x = (viewport->minx + viewport->maxx) / 2;
+	center_y = (viewport->miny + viewport->maxy) / 2;
+
+	if (waiter->ext.minx <= center_x && center_x <= waiter->ext.maxx
+		&& waiter->ext.miny <= center_y && center_y <= waiter->ext.maxy)
+		{
+			waiter->rank = RANK_CENTER;
+			return;
+		}
+
+	/* squared distance relative to the viewport, comparable between owners */
+	dx = (waiter->ext.minx + waiter->ext.maxx) / 2 - center_x;
+	dy = (waiter->ext.miny + waiter->ext.maxy) / 2 - center_y;
+	size = (viewport->maxx - viewport->minx) * (viewport->maxx - viewport->minx)
+		   + (viewport->maxy - viewport->miny) * (viewport->maxy - viewport->miny);
+
+	waiter->rank = RANK_VISIBLE;
+	waiter->distance = size > 0.0 ? (dx * dx + dy * dy) / size : 0.0;
+}
+
+static gboolean
+gtk_mapserver_context_job_rank (GtkMapserverContextJob *job)
+{
+	GList *l;
+	gboolean waited;
+
+	waited = FALSE;
+	job->rank = RANK_PREFETCH;
+	job->distance = G_MAXDOUBLE;
+
+	for (l = job->waiters; l != NULL; l = l->next)
+		{
+			GtkMapserverContextWaiter *waiter = (GtkMapserverContextWaiter *)l->data;
+
+			if (waiter->func == NULL)
+				{
+					continue;
+				}
+
+			waited = TRUE;
+			if (waiter->rank < job->rank
+				|| (waiter->rank == job->rank && waiter->distance < job->distance))
+				{
+					job->rank = waiter->rank;
+					job->distance = waiter->distance;
+				}
+		}
+
+	return waited;
+}
+
+static gint
+gtk_mapserver_context_job_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	const GtkMapserverContextJob *job_a = (const GtkMapserverContextJob *)a;
+	const GtkMapserverContextJob *job_b = (const GtkMapserverContextJob *)b;
+
+	if (job_a->rank != job_b->rank)
+		{
+			return job_a->rank < job_b->rank ? -1 : 1;
+		}
+	if (job_a->distance != job_b->distance)
+		{
+			return job_a->distance < job_b->distance ? -1 : 1;
+		}
+
+	return 0;
+}
+
+/* drops a job nobody waits for: pending ones are freed, running ones cancelled */
+static void
+gtk_mapserver_context_job_abandon (GtkMapserverContext *ctx, GtkMapserverContextJob *job)
+{
+	GtkMapserverContextPrivate *priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx);
+
+	if (!job->running)
+		{
+			g_queue_remove (priv->pending, job);
+			g_hash_table_remove (priv->jobs, job->url);
+			gtk_mapserver_context_job_free (job);
+			return;
+		}
+
+	/* a new request for the same url must not join a cancelled one; a
+	 * callback may already have started that new one */
+	if (g_hash_table_lookup (priv->jobs, job->url) == job)
+		{
+			g_hash_table_remove (priv->jobs, job->url);
+		}
+
+	g_mutex_lock (&priv->msg_lock);
+	job->abandoned = TRUE;
+	if (job->msg != NULL)
+		{
+			soup_session_cancel_message (priv->soup_session, job->msg, SOUP_STATUS_CANCELLED);
+		}
+	g_mutex_unlock (&priv->msg_lock);
+}
+
+static void
+gtk_mapserver_context_dispatch (GtkMapserverContext *ctx)
+{
+	GtkMapserverContextJob *job;
+
+	GtkMapserverContextPrivate *priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx);
+
+	while (priv->running < priv->max_connections
+		   && (job = g_queue_pop_head (priv->pending)) != NULL)
+		{
+			job->running = TRUE;
+			priv->running++;
+
+			/* released by job_done */
+			g_object_ref (ctx);
+			g_thread_pool_push (priv->pool, job, NULL);
+		}
+}
+
+/**
+ * gtk_mapserver_context_fetch:
+ * @ctx:
+ * @url:
+ * @func: called on the main loop with the decoded image, or NULL on error.
+ * @user_data:
+ *
+ * Requests @url through the shared session. Concurrent requests for the
+ * same url are merged into one, and a cached image is delivered at once,
+ * before this function returns.
+ *
+ * Returns: an id for gtk_mapserver_context_cancel(), or 0 if @func was
+ * already called.
+ */
+guint
+gtk_mapserver_context_fetch (GtkMapserverContext *ctx,
+							 const gchar *url,
+							 GtkMapserverContextFunc func,
+							 gpointer user_data)
+{
+	return gtk_mapserver_context_fetch_full (ctx, url,
+											 NULL, NULL, GTK_MAPSERVER_PRIORITY_VISIBLE,
+											 func, user_data);
+}
+
+/**
+ * gtk_mapserver_context_fetch_full:
+ * @ctx:
+ * @url:
+ * @owner: (allow-none): the viewport @ext belongs to, see gtk_mapserver_context_set_viewport().
+ * @ext: (allow-none): the extent rendered by @url.
+ * @priority:
+ * @func: called on the main loop with the decoded image, or NULL on error.
+ * @user_data:
+ *
+ * Like gtk_mapserver_context_fetch(), but the request is queued by
+ * @priority and by the distance of @ext from the centre of the viewport
+ * of @owner. A visible request that leaves that viewport is dropped
+ * without calling @func.
+ *
+ * Returns: an id for gtk_mapserver_context_cancel(), or 0 if @func was
+ * already called.
+ */
+guint
+gtk_mapserver_context_fetch_full (GtkMapserverContext *ctx,
+								  const gchar *url,
+								  gpointer owner,
+								  const GtkMapserverExtent *ext,
+								  GtkMapserverPriority priority,
+								  GtkMapserverContextFunc func,
+								  gpointer user_data)
+{
+	GtkMapserverContextJob *job;
+	GtkMapserverContextWaiter *waiter;
+	GdkPixbuf *pixbuf;
+	GBytes *bytes;
+
+	GtkMapserverContextPrivate *priv;
+
+	g_return_val_if_fail (GTK_IS_MAPSERVER_CONTEXT (ctx), 0);
+	g_return_val_if_fail (url != NULL, 0);
+	g_return_val_if_fail (func != NULL, 0);
+
+	priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx);
+
+	pixbuf = gtk_mapserver_cache_lookup_pixbuf (priv->cache, url);
+	if (pixbuf != NULL)
+		{
+			g_object_ref (pixbuf);
+			func (ctx, url, pixbuf, user_data);
+			g_object_unref (pixbuf);
+			return 0;
+		}
+
+	job = g_hash_table_lookup (priv->jobs, url);
+	if (job == NULL)
+		{
+			job = g_new0 (GtkMapserverContextJob, 1);
+			job->ctx = ctx;
+			job->url = g_strdup (url);
+
+			g_hash_table_insert (priv->jobs, job->url, job);
+
+			bytes = gtk_mapserver_cache_lookup_bytes (priv->cache, url);
+			if (bytes != NULL)
+				{
+					/* L2 hit: promote by decoding, no request */
+					job->bytes = g_bytes_ref (bytes);
+					job->local = TRUE;
+					job->running = TRUE;
+
+					g_object_ref (ctx);
+					g_thread_pool_push (priv->decode_pool, job, NULL);
+				}
+		}
+	else if (!job->running)
+		{
+			g_queue_remove (priv->pending, job);
+		}
+
+	if (++priv->next_id == 0)
+		{
+			priv->next_id = 1;
+		}
+
+	waiter = g_new0 (GtkMapserverContextWaiter, 1);
+	waiter->id = priv->next_id;
+	waiter->func = func;
+	waiter->user_data = user_data;
+	waiter->owner = owner;
+	waiter->has_ext = ext != NULL;
+	if (ext != NULL)
+		{
+			waiter->ext = *ext;
+		}
+	waiter->priority = priority;
+	gtk_mapserver_context_waiter_rank (ctx, waiter);
+
+	job->waiters = g_list_append (job->waiters, waiter);
+	g_hash_table_insert (priv->waiters, GUINT_TO_POINTER (waiter->id), job);
+
+	gtk_mapserver_context_job_rank (job);
+	if (!job->running)
+		{
+			g_queue_insert_sorted (priv->pending, job, gtk_mapserver_context_job_compare, NULL);
+		}
+
+	gtk_mapserver_context_dispatch (ctx);
+
+	return waiter->id;
+}
+
+/**
+ * gtk_mapserver_context_cancel:
+ * @ctx:
+ * @id: an id returned by gtk_mapserver_context_fetch().
+ *
+ * The callback will not be called. A request nobody waits for anymore is
+ * dropped, and cancelled if already running.
+ */
+void
+gtk_mapserver_context_cancel (GtkMapserverContext *ctx, guint id)
+{
+	GtkMapserverContextJob *job;
+	GList *l;
+	gboolean waited;
+
+	GtkMapserverContextPrivate *priv;
+
+	g_return_if_fail (GTK_IS_MAPSERVER_CONTEXT (ctx));
+
+	priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx);
+
+	job = g_hash_table_lookup (priv->waiters, GUINT_TO_POINTER (id));
+	if (job == NULL)
+		{
+			return;
+		}
+	g_hash_table_remove (priv->waiters, GUINT_TO_POINTER (id));
+
+	for (l = job->waiters; l != NULL; l = l->next)
+		{
+			GtkMapserverContextWaiter *waiter = (GtkMapserverContextWaiter *)l->data;
+
+			if (waiter->id == id)
+				{
+					waiter->func = NULL;
+				}
+		}
+
+	if (!gtk_mapserver_context_job_rank (job))
+		{
+			gtk_mapserver_context_job_abandon (ctx, job);
+		}
+	else if (!job->running)
+		{
+			g_queue_sort (priv->pending, gtk_mapserver_context_job_compare, NULL);
+		}
+}
+
+/**
+ * gtk_mapserver_context_set_viewport:
+ * @ctx:
+ * @owner:
+ * @viewport: (allow-none): the extent @owner shows now, NULL when it goes away.
+ *
+ * Re-ranks the requests of @owner around the new viewport and drops the
+ * visible ones that are no longer inside it.
+ */
+void
+gtk_mapserver_context_set_viewport (GtkMapserverContext *ctx,
+									gpointer owner,
+									const GtkMapserverExtent *viewport)
+{
+	GList *jobs;
+	GList *j;
+	GList *l;
+
+	GtkMapserverContextPrivate *priv;
+
+	g_return_if_fail (GTK_IS_MAPSERVER_CONTEXT (ctx));
+	g_return_if_fail (owner != NULL);
+
+	priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx);
+
+	if (viewport == NULL)
+		{
+			g_hash_table_remove (priv->viewports, owner);
+			return;
+		}
+
+	g_hash_table_replace (priv->viewports, owner, g_memdup (viewport, sizeof (GtkMapserverExtent)));
+
+	jobs = g_hash_table_get_values (priv->jobs);
+	for (j = jobs; j != NULL; j = j->next)
+		{
+			GtkMapserverContextJob *job = (GtkMapserverContextJob *)j->data;
+
+			for (l = job->waiters; l != NULL; l = l->next)
+				{
+					GtkMapserverContextWaiter *waiter = (GtkMapserverContextWaiter *)l->data;
+
+					if (waiter->func == NULL || waiter->owner != owner)
+						{
+							continue;
+						}
+
+					if (waiter->priority == GTK_MAPSERVER_PRIORITY_VISIBLE
+						&& waiter->has_ext
+						&& !gtk_mapserver_context_extent_intersects (&waiter->ext, viewport))
+						{
+							g_hash_table_remove (priv->waiters, GUINT_TO_POINTER (waiter->id));
+							waiter->func = NULL;
+						}
+					else
+						{
+							gtk_mapserver_context_waiter_rank (ctx, waiter);
+						}
+				}
+
+			if (!gtk_mapserver_context_job_rank (job))
+				{
+					gtk_mapserver_context_job_abandon (ctx, job);
+				}
+		}
+	g_list_free (jobs);
+
+	g_queue_sort (priv->pending, gtk_mapserver_context_job_compare, NULL);
+}
+
+/* PRIVATE */
+static void
+gtk_mapserver_context_set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec)
+{
+	GtkMapserverContext *ctx = GTK_MAPSERVER_CONTEXT (object);
+	GtkMapserverContextPrivate *priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx);
+
+	switch (property_id)
+		{
+			case PROP_MAX_CONNECTIONS:
+				priv->max_connections = g_value_get_uint (value);
+				g_object_set (G_OBJECT (priv->soup_session),
+							  SOUP_SESSION_MAX_CONNS, priv->max_connections,
+							  SOUP_SESSION_MAX_CONNS_PER_HOST, priv->max_connections,
+							  NULL);
+				g_thread_pool_set_max_threads (priv->pool, priv->max_connections, NULL);
+				gtk_mapserver_context_dispatch (ctx);
+				break;
+
+			case PROP_L1_SIZE:
+				gtk_mapserver_cache_set_l1_size (priv->cache, g_value_get_uint64 (value));
+				break;
+
+			case PROP_L2_SIZE:
+				gtk_mapserver_cache_set_l2_size (priv->cache, g_value_get_uint64 (value));
+				break;
+
+			default:
+				G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+				break;
+		}
+}
+
+static void
+gtk_mapserver_context_get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec)
+{
+	GtkMapserverContext *ctx = GTK_MAPSERVER_CONTEXT (object);
+	GtkMapserverContextPrivate *priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (ctx);
+
+	switch (property_id)
+		{
+			case PROP_MAX_CONNECTIONS:
+				g_value_set_uint (value, priv->max_connections);
+				break;
+
+			case PROP_L1_SIZE:
+				g_value_set_uint64 (value, gtk_mapserver_cache_get_l1_size (priv->cache));
+				break;
+
+			case PROP_L2_SIZE:
+				g_value_set_uint64 (value, gtk_mapserver_cache_get_l2_size (priv->cache));
+				break;
+
+			default:
+				G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+				break;
+		}
+}
+
+static void
+gtk_mapserver_context_finalize (GObject *object)
+{
+	GtkMapserverContextJob *job;
+
+	GtkMapserverContextPrivate *priv = GTK_MAPSERVER_CONTEXT_GET_PRIVATE (object);
+
+	/* running jobs hold a reference, so only pending ones are left */
+	g_thread_pool_free (priv->pool, TRUE, TRUE);
+	g_thread_pool_free (priv->decode_pool, TRUE, TRUE);
+	while ((job = g_queue_pop_head (priv->pending)) != NULL)
+		{
+			gtk_mapserver_context_job_free (job);
+		}
+	g_queue_free (priv->pending);
+	g_hash_table_destroy (priv->jobs);
+	g_hash_table_destroy (priv->waiters);
+	g_hash_table_destroy (priv->viewports);
+	g_mutex_clear (&priv->msg_lock);
+	g_mutex_clear (&priv->link_lock);
+
+	gtk_mapserver_cache_free (priv->cache);
+
+	g_object_unref (priv->soup_session);
+
+	G_OBJECT_CLASS (gtk_mapserver_context_parent_class)->finalize (object);
+}
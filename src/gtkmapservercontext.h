@@ -0,0 +1,126 @@
+/*
+ *  gtkmapservercontext.h
+ *
+ *  Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This file is part of libgtkmapserver.
+ *
+ *  libgtkmapserver is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libgtkmapserver is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libgtkmapserver; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __GTK_MAPSERVER_CONTEXT_H__
+#define __GTK_MAPSERVER_CONTEXT_H__
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <libsoup/soup.h>
+
+
+G_BEGIN_DECLS
+
+
+#define GTK_TYPE_MAPSERVER_CONTEXT                 (gtk_mapserver_context_get_type ())
+#define GTK_MAPSERVER_CONTEXT(obj)                 (G_TYPE_CHECK_INSTANCE_CAST ((obj), GTK_TYPE_MAPSERVER_CONTEXT, GtkMapserverContext))
+#define GTK_MAPSERVER_CONTEXT_CLASS(klass)         (G_TYPE_CHECK_CLASS_CAST ((klass), GTK_TYPE_MAPSERVER_CONTEXT, GtkMapserverContextClass))
+#define GTK_IS_MAPSERVER_CONTEXT(obj)              (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GTK_TYPE_MAPSERVER_CONTEXT))
+#define GTK_IS_MAPSERVER_CONTEXT_CLASS(klass)      (G_TYPE_CHECK_CLASS_TYPE ((klass), GTK_TYPE_MAPSERVER_CONTEXT))
+#define GTK_MAPSERVER_CONTEXT_GET_CLASS(obj)       (G_TYPE_INSTANCE_GET_CLASS ((obj), GTK_TYPE_MAPSERVER_CONTEXT, GtkMapserverContextClass))
+
+
+typedef struct _GtkMapserverContext GtkMapserverContext;
+typedef struct _GtkMapserverContextClass GtkMapserverContextClass;
+
+struct _GtkMapserverContext
+	{
+		GObject parent;
+	};
+
+struct _GtkMapserverContextClass
+	{
+		GObjectClass parent_class;
+	};
+
+GType gtk_mapserver_context_get_type (void) G_GNUC_CONST;
+
+
+typedef struct
+	{
+		gdouble minx;
+		gdouble miny;
+		gdouble maxx;
+		gdouble maxy;
+	} GtkMapserverExtent;
+
+typedef struct
+	{
+		guint64 l1_hits;
+		guint64 l1_misses;
+		guint64 l1_used;
+		guint64 l1_size;
+
+		guint64 l2_hits;
+		guint64 l2_misses;
+		guint64 l2_used;
+		guint64 l2_size;
+	} GtkMapserverCacheStats;
+
+typedef enum
+	{
+		GTK_MAPSERVER_PRIORITY_VISIBLE,
+		GTK_MAPSERVER_PRIORITY_PREFETCH
+	} GtkMapserverPriority;
+
+
+GtkMapserverContext *gtk_mapserver_context_new (void);
+GtkMapserverContext *gtk_mapserver_context_get_default (void);
+
+SoupSession *gtk_mapserver_context_get_soup_session (GtkMapserverContext *ctx);
+
+typedef void (*GtkMapserverContextFunc) (GtkMapserverContext *ctx,
+										 const gchar *url,
+										 GdkPixbuf *pixbuf,
+										 gpointer user_data);
+
+guint gtk_mapserver_context_fetch (GtkMapserverContext *ctx,
+								   const gchar *url,
+								   GtkMapserverContextFunc func,
+								   gpointer user_data);
+guint gtk_mapserver_context_fetch_full (GtkMapserverContext *ctx,
+										const gchar *url,
+										gpointer owner,
+										const GtkMapserverExtent *ext,
+										GtkMapserverPriority priority,
+										GtkMapserverContextFunc func,
+										gpointer user_data);
+void gtk_mapserver_context_cancel (GtkMapserverContext *ctx, guint id);
+
+void gtk_mapserver_context_get_cache_stats (GtkMapserverContext *ctx, GtkMapserverCacheStats *stats);
+
+gboolean gtk_mapserver_context_pin (GtkMapserverContext *ctx, const gchar *url, GdkPixbuf *pixbuf);
+void gtk_mapserver_context_unpin (GtkMapserverContext *ctx, const gchar *url);
+
+gboolean gtk_mapserver_context_get_link_estimate (GtkMapserverContext *ctx, gdouble *latency, gdouble *throughput);
+
+void gtk_mapserver_context_set_viewport (GtkMapserverContext *ctx,
+										 gpointer owner,
+										 const GtkMapserverExtent *viewport);
+
+
+G_END_DECLS
+
+#endif /* __GTK_MAPSERVER_CONTEXT_H__ */
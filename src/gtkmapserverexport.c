@@ -0,0 +1,726 @@
+/*
+ *  gtkmapserverexport.c
+ *
+ *  Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This file is part of libgtkmapserver.
+ *
+ *  libgtkmapserver is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libgtkmapserver is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libgtkmapserver; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include <png.h>
+#ifdef HAVE_LIBTIFF
+	#include <tiffio.h>
+#endif
+
+#include "gtkmapserverexport.h"
+
+/* each sub-render is at most TILE_WIDTH x STRIP_HEIGHT, well under the
+ * mapsize mapserv accepts by default */
+#define TILE_WIDTH 2048
+#define STRIP_HEIGHT 512
+/* strips fetched while the previous one is written: peak memory is
+ * about (STRIPS_AHEAD + 1) * width * STRIP_HEIGHT * 4 bytes */
+#define STRIPS_AHEAD 2
+#define STRIPS (STRIPS_AHEAD + 1)
+
+typedef struct
+	{
+		GdkPixbuf **tiles;
+		guint done;
+	} GtkMapserverExportStrip;
+
+typedef struct
+	{
+		SoupSession *session;
+		guint connections;
+		gchar *filename;
+		GtkMapserverExportFormat format;
+		gint width;
+		gint height;
+		guint cols;
+		guint rows;
+		gchar **urls;
+
+		GMutex lock;
+		GCond cond;
+		GtkMapserverExportStrip strips[STRIPS];
+		gboolean stop;
+		gchar *failed_url;
+	} GtkMapserverExportJob;
+
+typedef struct
+	{
+		GtkMapserverExportJob *job;
+		GCancellable *cancellable;
+		guint row;
+		guint col;
+	} GtkMapserverExportTile;
+
+typedef struct
+	{
+		GtkMapserverExportFormat format;
+		FILE *fp;
+		png_structp png;
+		png_infop info;
+#ifdef HAVE_LIBTIFF
+		TIFF *tif;
+#endif
+		guint32 row;
+	} GtkMapserverExportWriter;
+
+static GtkMapserverExportWriter
+*gtk_mapserver_export_writer_open (GtkMapserverExportFormat format,
+								   const gchar *filename,
+								   gint width,
+								   gint height,
+								   GError **error)
+{
+	GtkMapserverExportWriter *writer;
+
+	writer = g_new0 (GtkMapserverExportWriter, 1);
+	writer->format = format;
+
+	if (format == GTK_MAPSERVER_EXPORT_TIFF)
+		{
+#ifdef HAVE_LIBTIFF
+			/* classic tiff offsets are 32 bit */
+			writer->tif = TIFFOpen (filename, (guint64)width * height * 3 > G_MAXUINT32 ? "w8" : "w");
+			if (writer->tif == NULL)
+				{
+					g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+								 "Unable to create '%s'.", filename);
+					g_free (writer);
+					return NULL;
+				}
+
+			TIFFSetField (writer->tif, TIFFTAG_IMAGEWIDTH, (guint32)width);
+			TIFFSetField (writer->tif, TIFFTAG_IMAGELENGTH, (guint32)height);
+			TIFFSetField (writer->tif, TIFFTAG_BITSPERSAMPLE, 8);
+			TIFFSetField (writer->tif, TIFFTAG_SAMPLESPERPIXEL, 3);
+			TIFFSetField (writer->tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+			TIFFSetField (writer->tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+			TIFFSetField (writer->tif, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
+			TIFFSetField (writer->tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize (writer->tif, 0));
+
+			return writer;
+#else
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+						 "Built without tiff support.");
+			g_free (writer);
+			return NULL;
+#endif
+		}
+
+	writer->fp = g_fopen (filename, "wb");
+	if (writer->fp == NULL)
+		{
+			gint errsv = errno;
+
+			g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+						 "Unable to create '%s': %s.", filename, g_strerror (errsv));
+			g_free (writer);
+			return NULL;
+		}
+
+	writer->png = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	writer->info = png_create_info_struct (writer->png);
+	if (setjmp (png_jmpbuf (writer->png)))
+		{
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+						 "Unable to write png header to '%s'.", filename);
+			png_destroy_write_struct (&writer->png, &writer->info);
+			fclose (writer->fp);
+			g_free (writer);
+			return NULL;
+		}
+
+	png_init_io (writer->png, writer->fp);
+	png_set_IHDR (writer->png, writer->info,
+				  width, height, 8,
+				  PNG_COLOR_TYPE_RGB,
+				  PNG_INTERLACE_NONE,
+				  PNG_COMPRESSION_TYPE_DEFAULT,
+				  PNG_FILTER_TYPE_DEFAULT);
+	png_write_info (writer->png, writer->info);
+
+	return writer;
+}
+
+static gboolean
+gtk_mapserver_export_writer_write_row (GtkMapserverExportWriter *writer, guchar *row, GError **error)
+{
+	if (writer->format == GTK_MAPSERVER_EXPORT_TIFF)
+		{
+#ifdef HAVE_LIBTIFF
+			if (TIFFWriteScanline (writer->tif, row, writer->row, 0) < 0)
+				{
+					g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+								 "Unable to write row %u.", writer->row);
+					return FALSE;
+				}
+#endif
+		}
+	else
+		{
+			if (setjmp (png_jmpbuf (writer->png)))
+				{
+					g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+								 "Unable to write row %u.", writer->row);
+					return FALSE;
+				}
+			png_write_row (writer->png, row);
+		}
+
+	writer->row++;
+	return TRUE;
+}
+
+/* with complete FALSE only releases the writer */
+static gboolean
+gtk_mapserver_export_writer_close (GtkMapserverExportWriter *writer, gboolean complete, GError **error)
+{
+	gboolean ret;
+
+	ret = TRUE;
+	if (writer->format == GTK_MAPSERVER_EXPORT_TIFF)
+		{
+#ifdef HAVE_LIBTIFF
+			TIFFClose (writer->tif);
+#endif
+		}
+	else
+		{
+			if (setjmp (png_jmpbuf (writer->png)))
+				{
+					g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+								 "Unable to complete the png.");
+					ret = FALSE;
+				}
+			else if (complete)
+				{
+					png_write_end (writer->png, writer->info);
+				}
+			png_destroy_write_struct (&writer->png, &writer->info);
+
+			if (fclose (writer->fp) != 0 && ret && complete)
+				{
+					gint errsv = errno;
+
+					g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+								 "Unable to complete the png: %s.", g_strerror (errsv));
+					ret = FALSE;
+				}
+		}
+
+	g_free (writer);
+
+	return ret;
+}
+
+static void
+gtk_mapserver_export_job_free (gpointer data)
+{
+	GtkMapserverExportJob *job = (GtkMapserverExportJob *)data;
+	guint i;
+	guint c;
+
+	for (i = 0; i < STRIPS; i++)
+		{
+			for (c = 0; c < job->cols; c++)
+				{
+					if (job->strips[i].tiles[c] != NULL)
+						{
+							g_object_unref (job->strips[i].tiles[c]);
+						}
+				}
+			g_free (job->strips[i].tiles);
+		}
+
+	g_object_unref (job->session);
+	g_free (job->filename);
+	g_strfreev (job->urls);
+	g_free (job->failed_url);
+	g_mutex_clear (&job->lock);
+	g_cond_clear (&job->cond);
+	g_free (job);
+}
+
+/* urls are built here, in the caller's thread: the rest only needs the
+ * session */
+static GtkMapserverExportJob
+*gtk_mapserver_export_job_new (GtkMapserver *gtkm,
+							   const GtkMapserverExtent *ext,
+							   gint width,
+							   gint height,
+							   const gchar *filename,
+							   GtkMapserverExportFormat format,
+							   GError **error)
+{
+	GtkMapserverExportJob *job;
+	GtkMapserverContext *ctx;
+	GtkMapserverExtent tile;
+	gdouble scale_x;
+	gdouble scale_y;
+	guint row;
+	guint col;
+	guint i;
+
+	if (width <= 0 || height <= 0
+		|| ext->maxx <= ext->minx || ext->maxy <= ext->miny)
+		{
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+						 "The image or the extent is empty.");
+			return NULL;
+		}
+
+#ifndef HAVE_LIBTIFF
+	if (format == GTK_MAPSERVER_EXPORT_TIFF)
+		{
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+						 "Built without tiff support.");
+			return NULL;
+		}
+#endif
+
+	job = g_new0 (GtkMapserverExportJob, 1);
+	job->filename = g_strdup (filename);
+	job->format = format;
+	job->width = width;
+	job->height = height;
+	job->cols = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+	job->rows = (height + STRIP_HEIGHT - 1) / STRIP_HEIGHT;
+	job->urls = g_new0 (gchar *, job->cols * job->rows + 1);
+	g_mutex_init (&job->lock);
+	g_cond_init (&job->cond);
+	for (i = 0; i < STRIPS; i++)
+		{
+			job->strips[i].tiles = g_new0 (GdkPixbuf *, job->cols);
+		}
+
+	g_object_get (G_OBJECT (gtkm), "context", &ctx, NULL);
+	job->session = g_object_ref (gtk_mapserver_context_get_soup_session (ctx));
+	g_object_get (G_OBJECT (ctx), "max-connections", &job->connections, NULL);
+	g_object_unref (ctx);
+
+	/* the session is shared, outside of the context queue: half of the
+	 * connections stay free for the visible and prefetch renders */
+	job->connections = MAX (1, job->connections / 2);
+
+	scale_x = (ext->maxx - ext->minx) / width;
+	scale_y = (ext->maxy - ext->miny) / height;
+	for (row = 0; row < job->rows; row++)
+		{
+			for (col = 0; col < job->cols; col++)
+				{
+					gint x = col * TILE_WIDTH;
+					gint y = row * STRIP_HEIGHT;
+					gint w = MIN (TILE_WIDTH, width - x);
+					gint h = MIN (STRIP_HEIGHT, height - y);
+
+					tile.minx = ext->minx + x * scale_x;
+					tile.maxx = ext->minx + (x + w) * scale_x;
+					tile.maxy = ext->maxy - y * scale_y;
+					tile.miny = ext->maxy - (y + h) * scale_y;
+
+					job->urls[row * job->cols + col] = gtk_mapserver_get_url (gtkm, &tile, w, h);
+					if (job->urls[row * job->cols + col] == NULL)
+						{
+							g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+										 "You must set the map home before exporting.");
+							gtk_mapserver_export_job_free (job);
+							return NULL;
+						}
+				}
+		}
+
+	return job;
+}
+
+static void
+gtk_mapserver_export_tile_fetch (gpointer data, gpointer user_data)
+{
+	GtkMapserverExportTile *tile = (GtkMapserverExportTile *)data;
+	GtkMapserverExportJob *job = tile->job;
+
+	const gchar *url;
+	SoupMessage *msg;
+	GdkPixbufLoader *pxb_loader;
+	GdkPixbuf *pixbuf;
+	gboolean stop;
+
+	url = job->urls[tile->row * job->cols + tile->col];
+	pixbuf = NULL;
+
+	g_mutex_lock (&job->lock);
+	stop = job->stop;
+	g_mutex_unlock (&job->lock);
+
+	if (!stop && !g_cancellable_is_cancelled (tile->cancellable))
+		{
+			msg = soup_message_new (SOUP_METHOD_GET, url);
+			if (SOUP_IS_MESSAGE (msg))
+				{
+					soup_message_set_flags (msg, SOUP_MESSAGE_NO_REDIRECT);
+					soup_session_send_message (job->session, msg);
+
+					if (SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+						{
+							pxb_loader = gdk_pixbuf_loader_new ();
+							if (gdk_pixbuf_loader_write (pxb_loader,
+														 (const guchar *)msg->response_body->data,
+														 msg->response_body->length,
+														 NULL)
+								&& gdk_pixbuf_loader_close (pxb_loader, NULL))
+								{
+									pixbuf = g_object_ref (gdk_pixbuf_loader_get_pixbuf (pxb_loader));
+								}
+							else
+								{
+									gdk_pixbuf_loader_close (pxb_loader, NULL);
+								}
+							g_object_unref (pxb_loader);
+						}
+					g_object_unref (msg);
+				}
+		}
+
+	g_mutex_lock (&job->lock);
+	if (pixbuf == NULL && job->failed_url == NULL && !job->stop)
+		{
+			job->failed_url = g_strdup (url);
+		}
+	job->strips[tile->row % STRIPS].tiles[tile->col] = pixbuf;
+	job->strips[tile->row % STRIPS].done++;
+	g_cond_broadcast (&job->cond);
+	g_mutex_unlock (&job->lock);
+
+	g_free (tile);
+}
+
+static void
+gtk_mapserver_export_strip_fetch (GtkMapserverExportJob *job, GThreadPool *pool, guint row, GCancellable *cancellable)
+{
+	GtkMapserverExportTile *tile;
+	guint col;
+
+	for (col = 0; col < job->cols; col++)
+		{
+			tile = g_new0 (GtkMapserverExportTile, 1);
+			tile->job = job;
+			tile->cancellable = cancellable;
+			tile->row = row;
+			tile->col = col;
+
+			g_thread_pool_push (pool, tile, NULL);
+		}
+}
+
+/* flattens the strip over white, one output row at a time */
+static gboolean
+gtk_mapserver_export_strip_write (GtkMapserverExportJob *job,
+								  GtkMapserverExportWriter *writer,
+								  GtkMapserverExportStrip *strip,
+								  gint strip_height,
+								  guchar *buffer,
+								  GError **error)
+{
+	gint y;
+	gint x;
+	guint col;
+
+	for (y = 0; y < strip_height; y++)
+		{
+			for (col = 0; col < job->cols; col++)
+				{
+					GdkPixbuf *pixbuf = strip->tiles[col];
+					gint x0 = col * TILE_WIDTH;
+					gint w = MIN (TILE_WIDTH, job->width - x0);
+					guchar *out = buffer + x0 * 3;
+					const guchar *in;
+					gint n_channels;
+					gint pw;
+
+					if (pixbuf == NULL || y >= gdk_pixbuf_get_height (pixbuf))
+						{
+							memset (out, 0xff, w * 3);
+							continue;
+						}
+
+					n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+					in = gdk_pixbuf_get_pixels (pixbuf) + y * gdk_pixbuf_get_rowstride (pixbuf);
+					pw = MIN (w, gdk_pixbuf_get_width (pixbuf));
+
+					for (x = 0; x < pw; x++, in += n_channels, out += 3)
+						{
+							if (n_channels == 4)
+								{
+									guint a = in[3];
+
+									out[0] = (in[0] * a + 255 * (255 - a) + 127) / 255;
+									out[1] = (in[1] * a + 255 * (255 - a) + 127) / 255;
+									out[2] = (in[2] * a + 255 * (255 - a) + 127) / 255;
+								}
+							else
+								{
+									out[0] = in[0];
+									out[1] = in[1];
+									out[2] = in[2];
+								}
+						}
+					memset (out, 0xff, (w - pw) * 3);
+				}
+
+			if (!gtk_mapserver_export_writer_write_row (writer, buffer, error))
+				{
+					return FALSE;
+				}
+		}
+
+	return TRUE;
+}
+
+static gboolean
+gtk_mapserver_export_run (GtkMapserverExportJob *job, GCancellable *cancellable, GError **error)
+{
+	GtkMapserverExportWriter *writer;
+	GtkMapserverExportStrip *strip;
+	GThreadPool *pool;
+	guchar *buffer;
+	gboolean ret;
+	guint row;
+	guint col;
+
+	writer = gtk_mapserver_export_writer_open (job->format, job->filename, job->width, job->height, error);
+	if (writer == NULL)
+		{
+			return FALSE;
+		}
+
+	pool = g_thread_pool_new (gtk_mapserver_export_tile_fetch, NULL, job->connections, FALSE, NULL);
+	for (row = 0; row < MIN (job->rows, STRIPS); row++)
+		{
+			gtk_mapserver_export_strip_fetch (job, pool, row, cancellable);
+		}
+
+	buffer = g_malloc (job->width * 3);
+	ret = TRUE;
+	for (row = 0; row < job->rows && ret; row++)
+		{
+			strip = &job->strips[row % STRIPS];
+
+			g_mutex_lock (&job->lock);
+			while (strip->done < job->cols
+				   && job->failed_url == NULL
+				   && !g_cancellable_is_cancelled (cancellable))
+				{
+					g_cond_wait_until (&job->cond, &job->lock, g_get_monotonic_time () + G_USEC_PER_SEC / 10);
+				}
+			g_mutex_unlock (&job->lock);
+
+			if (g_cancellable_set_error_if_cancelled (cancellable, error))
+				{
+					ret = FALSE;
+					break;
+				}
+			if (job->failed_url != NULL)
+				{
+					g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+								 "Error on retrieving url: %s.", job->failed_url);
+					ret = FALSE;
+					break;
+				}
+
+			ret = gtk_mapserver_export_strip_write (job, writer, strip,
+													MIN (STRIP_HEIGHT, job->height - (gint)row * STRIP_HEIGHT),
+													buffer, error);
+
+			/* the slot is free for the strip STRIPS rows ahead */
+			for (col = 0; col < job->cols; col++)
+				{
+					g_clear_object (&strip->tiles[col]);
+				}
+			strip->done = 0;
+
+			if (ret && row + STRIPS < job->rows)
+				{
+					gtk_mapserver_export_strip_fetch (job, pool, row + STRIPS, cancellable);
+				}
+		}
+	g_free (buffer);
+
+	/* what is still queued returns without fetching */
+	g_mutex_lock (&job->lock);
+	job->stop = TRUE;
+	g_mutex_unlock (&job->lock);
+	g_thread_pool_free (pool, FALSE, TRUE);
+
+	if (!gtk_mapserver_export_writer_close (writer, ret, ret ? error : NULL))
+		{
+			ret = FALSE;
+		}
+	if (!ret)
+		{
+			g_unlink (job->filename);
+		}
+
+	return ret;
+}
+
+/**
+ * gtk_mapserver_export:
+ * @gtkm:
+ * @ext: the extent to export.
+ * @width: width of the image in pixels.
+ * @height: height of the image in pixels.
+ * @filename:
+ * @format:
+ * @cancellable: (allow-none):
+ * @error:
+ *
+ * Renders @ext into an image of any size. It is fetched from mapserv as
+ * sub-renders in parallel, over the session of the map context but on at
+ * most half of its #GtkMapserverContext:max-connections, and
+ * written in row strips, so memory does not grow with the image.
+ * Blocks until the file is complete; see gtk_mapserver_export_async().
+ *
+ * Returns: TRUE on success; on failure no file is left behind.
+ */
+gboolean
+gtk_mapserver_export (GtkMapserver *gtkm,
+					  const GtkMapserverExtent *ext,
+					  gint width,
+					  gint height,
+					  const gchar *filename,
+					  GtkMapserverExportFormat format,
+					  GCancellable *cancellable,
+					  GError **error)
+{
+	GtkMapserverExportJob *job;
+	gboolean ret;
+
+	g_return_val_if_fail (GTK_IS_MAPSERVER (gtkm), FALSE);
+	g_return_val_if_fail (ext != NULL, FALSE);
+	g_return_val_if_fail (filename != NULL, FALSE);
+
+	job = gtk_mapserver_export_job_new (gtkm, ext, width, height, filename, format, error);
+	if (job == NULL)
+		{
+			return FALSE;
+		}
+
+	ret = gtk_mapserver_export_run (job, cancellable, error);
+	gtk_mapserver_export_job_free (job);
+
+	return ret;
+}
+
+static void
+gtk_mapserver_export_thread (GTask *task,
+							 gpointer source_object,
+							 gpointer task_data,
+							 GCancellable *cancellable)
+{
+	GError *error;
+
+	error = NULL;
+	if (gtk_mapserver_export_run ((GtkMapserverExportJob *)task_data, cancellable, &error))
+		{
+			g_task_return_boolean (task, TRUE);
+		}
+	else
+		{
+			g_task_return_error (task, error);
+		}
+}
+
+/**
+ * gtk_mapserver_export_async:
+ * @gtkm:
+ * @ext:
+ * @width:
+ * @height:
+ * @filename:
+ * @format:
+ * @cancellable: (allow-none):
+ * @callback:
+ * @user_data:
+ *
+ * Like gtk_mapserver_export(), writing the file in a thread.
+ */
+void
+gtk_mapserver_export_async (GtkMapserver *gtkm,
+							const GtkMapserverExtent *ext,
+							gint width,
+							gint height,
+							const gchar *filename,
+							GtkMapserverExportFormat format,
+							GCancellable *cancellable,
+							GAsyncReadyCallback callback,
+							gpointer user_data)
+{
+	GtkMapserverExportJob *job;
+	GTask *task;
+	GError *error;
+
+	g_return_if_fail (GTK_IS_MAPSERVER (gtkm));
+	g_return_if_fail (ext != NULL);
+	g_return_if_fail (filename != NULL);
+
+	task = g_task_new (gtkm, cancellable, callback, user_data);
+
+	error = NULL;
+	job = gtk_mapserver_export_job_new (gtkm, ext, width, height, filename, format, &error);
+	if (job == NULL)
+		{
+			g_task_return_error (task, error);
+		}
+	else
+		{
+			g_task_set_task_data (task, job, gtk_mapserver_export_job_free);
+			g_task_run_in_thread (task, gtk_mapserver_export_thread);
+		}
+
+	g_object_unref (task);
+}
+
+/**
+ * gtk_mapserver_export_finish:
+ * @gtkm:
+ * @result:
+ * @error:
+ *
+ * Returns: TRUE if the file was written.
+ */
+gboolean
+gtk_mapserver_export_finish (GtkMapserver *gtkm,
+							 GAsyncResult *result,
+							 GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, gtkm), FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
@@ -0,0 +1,67 @@
+/*
+ *  gtkmapserverexport.h
+ *
+ *  Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This file is part of libgtkmapserver.
+ *
+ *  libgtkmapserver is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libgtkmapserver is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libgtkmapserver; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __GTK_MAPSERVER_EXPORT_H__
+#define __GTK_MAPSERVER_EXPORT_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "gtkmapserver.h"
+
+
+G_BEGIN_DECLS
+
+
+typedef enum
+	{
+		GTK_MAPSERVER_EXPORT_PNG,
+		GTK_MAPSERVER_EXPORT_TIFF
+	} GtkMapserverExportFormat;
+
+gboolean gtk_mapserver_export (GtkMapserver *gtkm,
+							   const GtkMapserverExtent *ext,
+							   gint width,
+							   gint height,
+							   const gchar *filename,
+							   GtkMapserverExportFormat format,
+							   GCancellable *cancellable,
+							   GError **error);
+
+void gtk_mapserver_export_async (GtkMapserver *gtkm,
+								 const GtkMapserverExtent *ext,
+								 gint width,
+								 gint height,
+								 const gchar *filename,
+								 GtkMapserverExportFormat format,
+								 GCancellable *cancellable,
+								 GAsyncReadyCallback callback,
+								 gpointer user_data);
+gboolean gtk_mapserver_export_finish (GtkMapserver *gtkm,
+									  GAsyncResult *result,
+									  GError **error);
+
+
+G_END_DECLS
+
+#endif /* __GTK_MAPSERVER_EXPORT_H__ */
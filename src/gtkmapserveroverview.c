@@ -0,0 +1,588 @@
+/*
+ *  gtkmapserveroverview.c
+ *
+ *  Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This file is part of libgtkmapserver.
+ *
+ *  libgtkmapserver is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libgtkmapserver is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libgtkmapserver; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "gtkmapserveroverview.h"
+
+enum
+{
+	PROP_0,
+	PROP_MAPSERVER
+};
+
+static void gtk_mapserver_overview_class_init (GtkMapserverOverviewClass *klass);
+static void gtk_mapserver_overview_init (GtkMapserverOverview *overview);
+
+static void gtk_mapserver_overview_set_property (GObject *object,
+                               guint property_id,
+                               const GValue *value,
+                               GParamSpec *pspec);
+static void gtk_mapserver_overview_get_property (GObject *object,
+                               guint property_id,
+                               GValue *value,
+                               GParamSpec *pspec);
+
+static void gtk_mapserver_overview_dispose (GObject *object);
+
+static void gtk_mapserver_overview_update (GtkMapserverOverview *overview);
+
+static void gtk_mapserver_overview_on_extent_changed (GtkMapserver *gtkm,
+													  gpointer user_data);
+
+static void gtk_mapserver_overview_on_size_allocate (GtkWidget *widget,
+													 GdkRectangle *allocation,
+													 gpointer user_data);
+
+static gboolean gtk_mapserver_overview_on_button_press_event (GtkWidget *widget,
+															  GdkEventButton *event,
+															  gpointer user_data);
+
+static gboolean gtk_mapserver_overview_on_button_release_event (GtkWidget *widget,
+																GdkEventButton *event,
+																gpointer user_data);
+
+static gboolean gtk_mapserver_overview_on_motion_notify_event (GtkWidget *widget,
+															   GdkEventMotion *event,
+															   gpointer user_data);
+
+#define GTK_MAPSERVER_OVERVIEW_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), GTK_TYPE_MAPSERVER_OVERVIEW, GtkMapserverOverviewPrivate))
+
+typedef struct _GtkMapserverOverviewPrivate GtkMapserverOverviewPrivate;
+struct _GtkMapserverOverviewPrivate
+	{
+		GooCanvasItem *root;
+		GooCanvasItem *img;
+		GooCanvasItem *rect;
+
+		GtkMapserver *gtkm;
+		gulong extent_changed_id;
+
+		GtkMapserverExtent home;
+		gchar *home_url;
+		gboolean has_home;
+		GdkPixbuf *pixbuf;
+		guint render_id;
+
+		gboolean dragging;
+		gboolean dragged;
+		gdouble drag_x;
+		gdouble drag_y;
+	};
+
+G_DEFINE_TYPE (GtkMapserverOverview, gtk_mapserver_overview, GOO_TYPE_CANVAS)
+
+static void
+gtk_mapserver_overview_class_init (GtkMapserverOverviewClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	g_type_class_add_private (object_class, sizeof (GtkMapserverOverviewPrivate));
+
+	object_class->set_property = gtk_mapserver_overview_set_property;
+	object_class->get_property = gtk_mapserver_overview_get_property;
+	object_class->dispose = gtk_mapserver_overview_dispose;
+
+	g_object_class_install_property (object_class, PROP_MAPSERVER,
+									 g_param_spec_object ("mapserver",
+														  "Mapserver",
+														  "The map this overview follows",
+														  GTK_TYPE_MAPSERVER,
+														  G_PARAM_READWRITE));
+}
+
+static void
+gtk_mapserver_overview_init (GtkMapserverOverview *overview)
+{
+	GtkMapserverOverviewPrivate *priv = GTK_MAPSERVER_OVERVIEW_GET_PRIVATE (overview);
+
+	priv->gtkm = NULL;
+	priv->extent_changed_id = 0;
+
+	priv->has_home = FALSE;
+	priv->home_url = NULL;
+	priv->pixbuf = NULL;
+	priv->render_id = 0;
+
+	priv->dragging = FALSE;
+	priv->dragged = FALSE;
+	priv->drag_x = 0.0;
+	priv->drag_y = 0.0;
+
+	g_signal_connect (G_OBJECT (overview), "size-allocate",
+	                  G_CALLBACK (gtk_mapserver_overview_on_size_allocate), (gpointer)overview);
+
+	g_signal_connect (G_OBJECT (overview), "button-press-event",
+	                  G_CALLBACK (gtk_mapserver_overview_on_button_press_event), (gpointer)overview);
+	g_signal_connect (G_OBJECT (overview), "button-release-event",
+	                  G_CALLBACK (gtk_mapserver_overview_on_button_release_event), (gpointer)overview);
+	g_signal_connect (G_OBJECT (overview), "motion-notify-event",
+	                  G_CALLBACK (gtk_mapserver_overview_on_motion_notify_event), (gpointer)overview);
+
+	g_object_set (G_OBJECT (overview),
+				  "background-color", "white",
+				  NULL);
+
+	priv->root = goo_canvas_get_root_item (GOO_CANVAS (overview));
+
+	priv->img = goo_canvas_image_new (priv->root,
+									  NULL,
+									  0, 0,
+									  NULL);
+
+	priv->rect = goo_canvas_rect_new (priv->root,
+									  0, 0, 0, 0,
+									  "stroke-color", "red",
+									  "line-width", 2.0,
+									  "fill-color-rgba", 0xff000033,
+									  "visibility", GOO_CANVAS_ITEM_HIDDEN,
+									  NULL);
+}
+
+/**
+ * gtk_mapserver_overview_new:
+ * @gtkm: the map to follow.
+ *
+ * Returns: the new created #GtkMapserverOverview object.
+ */
+GtkWidget
+*gtk_mapserver_overview_new (GtkMapserver *gtkm)
+{
+	GtkWidget *overview = GTK_WIDGET (g_object_new (gtk_mapserver_overview_get_type (),
+													"mapserver", gtkm,
+													NULL));
+
+	return overview;
+}
+
+/**
+ * gtk_mapserver_overview_set_mapserver:
+ * @overview:
+ * @gtkm:
+ */
+void
+gtk_mapserver_overview_set_mapserver (GtkMapserverOverview *overview, GtkMapserver *gtkm)
+{
+	GtkMapserverOverviewPrivate *priv = GTK_MAPSERVER_OVERVIEW_GET_PRIVATE (overview);
+
+	if (priv->gtkm == gtkm)
+		{
+			return;
+		}
+
+	if (priv->gtkm != NULL)
+		{
+			if (priv->render_id != 0)
+				{
+					gtk_mapserver_cancel_render (priv->gtkm, priv->render_id);
+					priv->render_id = 0;
+				}
+			g_signal_handler_disconnect (priv->gtkm, priv->extent_changed_id);
+			g_object_unref (priv->gtkm);
+			priv->gtkm = NULL;
+		}
+
+	priv->has_home = FALSE;
+	g_free (priv->home_url);
+	priv->home_url = NULL;
+	if (priv->pixbuf != NULL)
+		{
+			g_object_unref (priv->pixbuf);
+			priv->pixbuf = NULL;
+		}
+
+	if (gtkm != NULL)
+		{
+			priv->gtkm = g_object_ref (gtkm);
+			priv->extent_changed_id = g_signal_connect (G_OBJECT (gtkm), "extent-changed",
+														G_CALLBACK (gtk_mapserver_overview_on_extent_changed), (gpointer)overview);
+		}
+
+	gtk_mapserver_overview_update (overview);
+}
+
+/**
+ * gtk_mapserver_overview_get_mapserver:
+ * @overview:
+ *
+ * Returns: (transfer none): the followed map.
+ */
+GtkMapserver
+*gtk_mapserver_overview_get_mapserver (GtkMapserverOverview *overview)
+{
+	GtkMapserverOverviewPrivate *priv = GTK_MAPSERVER_OVERVIEW_GET_PRIVATE (overview);
+
+	return priv->gtkm;
+}
+
+/* PRIVATE */
+static void
+gtk_mapserver_overview_set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec)
+{
+	GtkMapserverOverview *overview = GTK_MAPSERVER_OVERVIEW (object);
+
+	switch (property_id)
+		{
+			case PROP_MAPSERVER:
+				gtk_mapserver_overview_set_mapserver (overview, g_value_get_object (value));
+				break;
+
+			default:
+				G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+				break;
+		}
+}
+
+static void
+gtk_mapserver_overview_get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec)
+{
+	GtkMapserverOverview *overview = GTK_MAPSERVER_OVERVIEW (object);
+	GtkMapserverOverviewPrivate *priv = GTK_MAPSERVER_OVERVIEW_GET_PRIVATE (overview);
+
+	switch (property_id)
+		{
+			case PROP_MAPSERVER:
+				g_value_set_object (value, priv->gtkm);
+				break;
+
+			default:
+				G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+				break;
+		}
+}
+
+static void
+gtk_mapserver_overview_dispose (GObject *object)
+{
+	gtk_mapserver_overview_set_mapserver (GTK_MAPSERVER_OVERVIEW (object), NULL);
+
+	G_OBJECT_CLASS (gtk_mapserver_overview_parent_class)->dispose (object);
+}
+
+static void
+gtk_mapserver_overview_update_image (GtkMapserverOverview *overview)
+{
+	GtkAllocation allocation;
+	GdkPixbuf *scaled;
+
+	GtkMapserverOverviewPrivate *priv = GTK_MAPSERVER_OVERVIEW_GET_PRIVATE (overview);
+
+	gtk_widget_get_allocation (GTK_WIDGET (overview), &allocation);
+
+	if (priv->pixbuf == NULL
+		|| allocation.width <= 1
+		|| allocation.height <= 1)
+		{
+			g_object_set (G_OBJECT (priv->img),
+						  "pixbuf", NULL,
+						  NULL);
+			return;
+		}
+
+	/* the home image is scaled locally, never rendered again */
+	scaled = gdk_pixbuf_scale_simple (priv->pixbuf,
+									  allocation.width,
+									  allocation.height,
+									  GDK_INTERP_BILINEAR);
+	g_object_set (G_OBJECT (priv->img),
+				  "pixbuf", scaled,
+				  NULL);
+	g_object_unref (scaled);
+}
+
+static void
+gtk_mapserver_overview_update_rect (GtkMapserverOverview *overview)
+{
+	GtkAllocation allocation;
+	GtkMapserverExtent cur;
+
+	gdouble sx;
+	gdouble sy;
+
+	GtkMapserverOverviewPrivate *priv = GTK_MAPSERVER_OVERVIEW_GET_PRIVATE (overview);
+
+	gtk_widget_get_allocation (GTK_WIDGET (overview), &allocation);
+
+	if (!priv->has_home
+		|| !gtk_mapserver_get_current_extent (priv->gtkm, &cur))
+		{
+			g_object_set (G_OBJECT (priv->rect),
+						  "visibility", GOO_CANVAS_ITEM_HIDDEN,
+						  NULL);
+			return;
+		}
+
+	sx = allocation.width / (priv->home.maxx - priv->home.minx);
+	sy = allocation.height / (priv->home.maxy - priv->home.miny);
+
+	g_object_set (G_OBJECT (priv->rect),
+				  "x", (cur.minx - priv->home.minx) * sx,
+				  "y", (priv->home.maxy - cur.maxy) * sy,
+				  "width", (cur.maxx - cur.minx) * sx,
+				  "height", (cur.maxy - cur.miny) * sy,
+				  "visibility", GOO_CANVAS_ITEM_VISIBLE,
+				  NULL);
+}
+
+static void
+gtk_mapserver_overview_on_rendered (GtkMapserverContext *ctx,
+									const gchar *url,
+									GdkPixbuf *pixbuf,
+									gpointer user_data)
+{
+	GtkMapserverOverview *overview = (GtkMapserverOverview *)user_data;
+	GtkMapserverOverviewPrivate *priv = GTK_MAPSERVER_OVERVIEW_GET_PRIVATE (overview);
+
+	priv->render_id = 0;
+
+	if (pixbuf == NULL)
+		{
+			return;
+		}
+
+	if (priv->pixbuf != NULL)
+		{
+			g_object_unref (priv->pixbuf);
+		}
+	priv->pixbuf = g_object_ref (pixbuf);
+
+	gtk_mapserver_overview_update_image (overview);
+}
+
+static void
+gtk_mapserver_overview_update (GtkMapserverOverview *overview)
+{
+	GtkAllocation allocation;
+	GtkMapserverExtent home;
+	gchar *home_url;
+
+	GtkMapserverOverviewPrivate *priv = GTK_MAPSERVER_OVERVIEW_GET_PRIVATE (overview);
+
+	if (priv->gtkm == NULL
+		|| !gtk_mapserver_get_home_extent (priv->gtkm, &home))
+		{
+			gtk_mapserver_overview_update_image (overview);
+			gtk_mapserver_overview_update_rect (overview);
+			return;
+		}
+
+	/* a new home may keep the extent and change the map: a url of any
+	 * size tells them apart */
+	home_url = gtk_mapserver_get_url (priv->gtkm, &home, 1, 1);
+
+	if (!priv->has_home
+		|| memcmp (&home, &priv->home, sizeof (GtkMapserverExtent)) != 0
+		|| g_strcmp0 (home_url, priv->home_url) != 0)
+		{
+			priv->home = home;
+			priv->has_home = TRUE;
+			g_free (priv->home_url);
+			priv->home_url = home_url;
+			home_url = NULL;
+
+			if (priv->render_id != 0)
+				{
+					gtk_mapserver_cancel_render (priv->gtkm, priv->render_id);
+				}
+
+			/* same size as the map's own home render, so it comes from cache */
+			gtk_widget_get_allocation (GTK_WIDGET (priv->gtkm), &allocation);
+			if (allocation.width <= 1 || allocation.height <= 1)
+				{
+					gtk_widget_get_allocation (GTK_WIDGET (overview), &allocation);
+				}
+
+			priv->render_id = gtk_mapserver_render (priv->gtkm,
+													&priv->home,
+													MAX (1, allocation.width),
+													MAX (1, allocation.height),
+													gtk_mapserver_overview_on_rendered,
+													overview);
+		}
+	g_free (home_url);
+
+	gtk_mapserver_overview_update_rect (overview);
+}
+
+/* SIGNALS */
+static void
+gtk_mapserver_overview_on_extent_changed (GtkMapserver *gtkm,
+										  gpointer user_data)
+{
+	GtkMapserverOverview *overview = (GtkMapserverOverview *)user_data;
+
+	gtk_mapserver_overview_update (overview);
+}
+
+static void
+gtk_mapserver_overview_on_size_allocate (GtkWidget *widget,
+										 GdkRectangle *allocation,
+										 gpointer user_data)
+{
+	GtkMapserverOverview *overview = (GtkMapserverOverview *)user_data;
+
+	gtk_mapserver_overview_update_image (overview);
+	gtk_mapserver_overview_update_rect (overview);
+}
+
+static gboolean
+gtk_mapserver_overview_on_button_press_event (GtkWidget *widget,
+											  GdkEventButton *event,
+											  gpointer user_data)
+{
+	GtkMapserverOverview *overview = (GtkMapserverOverview *)user_data;
+	GtkMapserverOverviewPrivate *priv = GTK_MAPSERVER_OVERVIEW_GET_PRIVATE (overview);
+
+	if (event->button == 1 && priv->has_home)
+		{
+			priv->dragging = TRUE;
+			priv->dragged = FALSE;
+			priv->drag_x = event->x;
+			priv->drag_y = event->y;
+			return TRUE;
+		}
+
+	return FALSE;
+}
+
+static gboolean
+gtk_mapserver_overview_on_button_release_event (GtkWidget *widget,
+												GdkEventButton *event,
+												gpointer user_data)
+{
+	GtkAllocation allocation;
+	GtkMapserverExtent cur;
+
+	gdouble x;
+	gdouble y;
+	gdouble width;
+	gdouble height;
+	gdouble center_x;
+	gdouble center_y;
+	gdouble half_x;
+	gdouble half_y;
+
+	GtkMapserverOverview *overview = (GtkMapserverOverview *)user_data;
+	GtkMapserverOverviewPrivate *priv = GTK_MAPSERVER_OVERVIEW_GET_PRIVATE (overview);
+
+	if (event->button != 1 || !priv->dragging)
+		{
+			return FALSE;
+		}
+	priv->dragging = FALSE;
+
+	if (!gtk_mapserver_get_current_extent (priv->gtkm, &cur))
+		{
+			return TRUE;
+		}
+
+	gtk_widget_get_allocation (GTK_WIDGET (overview), &allocation);
+
+	if (priv->dragged)
+		{
+			/* the rectangle was dragged: its center is the new map center */
+			g_object_get (G_OBJECT (priv->rect),
+						  "x", &x,
+						  "y", &y,
+						  "width", &width,
+						  "height", &height,
+						  NULL);
+			center_x = x + width / 2;
+			center_y = y + height / 2;
+		}
+	else
+		{
+			/* a click centers the map there */
+			center_x = event->x;
+			center_y = event->y;
+		}
+
+	half_x = (cur.maxx - cur.minx) / 2;
+	half_y = (cur.maxy - cur.miny) / 2;
+
+	center_x = priv->home.minx + center_x / allocation.width * (priv->home.maxx - priv->home.minx);
+	center_y = priv->home.maxy - center_y / allocation.height * (priv->home.maxy - priv->home.miny);
+
+	cur.minx = center_x - half_x;
+	cur.maxx = center_x + half_x;
+	cur.miny = center_y - half_y;
+	cur.maxy = center_y + half_y;
+
+	gtk_mapserver_set_current_extent (priv->gtkm, &cur);
+
+	return TRUE;
+}
+
+static gboolean
+gtk_mapserver_overview_on_motion_notify_event (GtkWidget *widget,
+											   GdkEventMotion *event,
+											   gpointer user_data)
+{
+	gint x;
+	gint y;
+	GdkModifierType state;
+
+	GtkMapserverOverview *overview = (GtkMapserverOverview *)user_data;
+	GtkMapserverOverviewPrivate *priv = GTK_MAPSERVER_OVERVIEW_GET_PRIVATE (overview);
+
+	if (!priv->dragging)
+		{
+			return FALSE;
+		}
+
+	if (event->is_hint)
+		{
+			gdk_window_get_device_position (event->window, event->device, &x, &y, &state);
+		}
+	else
+		{
+			x = event->x;
+			y = event->y;
+			state = event->state;
+		}
+
+	if (state & GDK_BUTTON1_MASK)
+		{
+			gdouble rx;
+			gdouble ry;
+
+			g_object_get (G_OBJECT (priv->rect),
+						  "x", &rx,
+						  "y", &ry,
+						  NULL);
+			g_object_set (G_OBJECT (priv->rect),
+						  "x", rx + x - priv->drag_x,
+						  "y", ry + y - priv->drag_y,
+						  NULL);
+
+			priv->drag_x = x;
+			priv->drag_y = y;
+			priv->dragged = TRUE;
+		}
+
+	return TRUE;
+}
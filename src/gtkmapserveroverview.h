@@ -0,0 +1,71 @@
+/*
+ *  gtkmapserveroverview.h
+ *
+ *  Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This file is part of libgtkmapserver.
+ *
+ *  libgtkmapserver is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libgtkmapserver is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libgtkmapserver; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __GTK_MAPSERVER_OVERVIEW_H__
+#define __GTK_MAPSERVER_OVERVIEW_H__
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gtk/gtk.h>
+
+#include <goocanvas.h>
+
+#include "gtkmapserver.h"
+
+
+G_BEGIN_DECLS
+
+
+#define GTK_TYPE_MAPSERVER_OVERVIEW                 (gtk_mapserver_overview_get_type ())
+#define GTK_MAPSERVER_OVERVIEW(obj)                 (G_TYPE_CHECK_INSTANCE_CAST ((obj), GTK_TYPE_MAPSERVER_OVERVIEW, GtkMapserverOverview))
+#define GTK_MAPSERVER_OVERVIEW_CLASS(klass)         (G_TYPE_CHECK_CLASS_CAST ((klass), GTK_TYPE_MAPSERVER_OVERVIEW, GtkMapserverOverviewClass))
+#define GTK_IS_MAPSERVER_OVERVIEW(obj)              (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GTK_TYPE_MAPSERVER_OVERVIEW))
+#define GTK_IS_MAPSERVER_OVERVIEW_CLASS(klass)      (G_TYPE_CHECK_CLASS_TYPE ((klass), GTK_TYPE_MAPSERVER_OVERVIEW))
+#define GTK_MAPSERVER_OVERVIEW_GET_CLASS(obj)       (G_TYPE_INSTANCE_GET_CLASS ((obj), GTK_TYPE_MAPSERVER_OVERVIEW, GtkMapserverOverviewClass))
+
+
+typedef struct _GtkMapserverOverview GtkMapserverOverview;
+typedef struct _GtkMapserverOverviewClass GtkMapserverOverviewClass;
+
+struct _GtkMapserverOverview
+	{
+		GooCanvas parent;
+	};
+
+struct _GtkMapserverOverviewClass
+	{
+		GooCanvasClass parent_class;
+	};
+
+GType gtk_mapserver_overview_get_type (void) G_GNUC_CONST;
+
+
+GtkWidget *gtk_mapserver_overview_new (GtkMapserver *gtkm);
+
+void gtk_mapserver_overview_set_mapserver (GtkMapserverOverview *overview, GtkMapserver *gtkm);
+GtkMapserver *gtk_mapserver_overview_get_mapserver (GtkMapserverOverview *overview);
+
+
+G_END_DECLS
+
+#endif /* __GTK_MAPSERVER_OVERVIEW_H__ */
@@ -0,0 +1,900 @@
+/*
+ *  gtkmapserverpack.c
+ *
+ *  Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This file is part of libgtkmapserver.
+ *
+ *  libgtkmapserver is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libgtkmapserver is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libgtkmapserver; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "gtkmapserverpack.h"
+#include "gtkmapservercache.h"
+
+/*
+ * Pack file layout, all numbers little-endian:
+ *
+ *   header   64 bytes: magic, version, tile size, levels count, tiles count, extent
+ *   levels   24 bytes each: scale (map units per pixel), cols, rows, first tile index
+ *   index    16 bytes each: data offset, data length, reserved
+ *   data     tile images as returned by mapserv, starting on a page boundary
+ *
+ * Tiles of a level are stored row by row starting from the upper left corner,
+ * so a tile is found at index first_tile + row * cols + col.
+ */
+#define PACK_MAGIC "GTKMSPAK"
+#define PACK_VERSION 1
+
+#define PACK_HEADER_SIZE 64
+#define PACK_LEVEL_SIZE 24
+#define PACK_INDEX_SIZE 16
+#define PACK_DATA_ALIGN 4096
+
+/* decoded tiles kept for the next renders, about 64 tiles of 256 pixels */
+#define PACK_TILES_SIZE (16 * 1024 * 1024)
+
+typedef struct
+	{
+		gdouble scale;
+		guint cols;
+		guint rows;
+		guint64 first_tile;
+	} GtkMapserverPackLevel;
+
+static void gtk_mapserver_pack_class_init (GtkMapserverPackClass *klass);
+static void gtk_mapserver_pack_init (GtkMapserverPack *pack);
+
+static void gtk_mapserver_pack_finalize (GObject *object);
+
+#define GTK_MAPSERVER_PACK_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), GTK_TYPE_MAPSERVER_PACK, GtkMapserverPackPrivate))
+
+typedef struct _GtkMapserverPackPrivate GtkMapserverPackPrivate;
+struct _GtkMapserverPackPrivate
+	{
+		GMappedFile *mfile;
+		GBytes *bytes;
+		const guchar *data;
+		gsize length;
+
+		GtkMapserverExtent ext;
+		guint tile_size;
+		guint n_levels;
+		GtkMapserverPackLevel *levels;
+		guint64 n_tiles;
+		const guchar *index;
+
+		GtkMapserverCache *tiles;
+	};
+
+G_DEFINE_TYPE (GtkMapserverPack, gtk_mapserver_pack, G_TYPE_OBJECT)
+
+struct _GtkMapserverPackWriter
+	{
+		GFileOutputStream *stream;
+		GMutex mutex;
+
+		GtkMapserverExtent ext;
+		guint tile_size;
+		guint n_levels;
+		GtkMapserverPackLevel *levels;
+		guint64 n_tiles;
+		guchar *index;
+
+		goffset pos;
+	};
+
+static guint32
+read_u32 (const guchar *p)
+{
+	guint32 v;
+
+	memcpy (&v, p, sizeof (v));
+	return GUINT32_FROM_LE (v);
+}
+
+static guint64
+read_u64 (const guchar *p)
+{
+	guint64 v;
+
+	memcpy (&v, p, sizeof (v));
+	return GUINT64_FROM_LE (v);
+}
+
+static gdouble
+read_double (const guchar *p)
+{
+	union
+		{
+			guint64 i;
+			gdouble d;
+		} u;
+
+	u.i = read_u64 (p);
+	return u.d;
+}
+
+static void
+write_u32 (guchar *p, guint32 v)
+{
+	v = GUINT32_TO_LE (v);
+	memcpy (p, &v, sizeof (v));
+}
+
+static void
+write_u64 (guchar *p, guint64 v)
+{
+	v = GUINT64_TO_LE (v);
+	memcpy (p, &v, sizeof (v));
+}
+
+static void
+write_double (guchar *p, gdouble d)
+{
+	union
+		{
+			guint64 i;
+			gdouble d;
+		} u;
+
+	u.d = d;
+	write_u64 (p, u.i);
+}
+
+static void
+gtk_mapserver_pack_class_init (GtkMapserverPackClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	g_type_class_add_private (object_class, sizeof (GtkMapserverPackPrivate));
+
+	object_class->finalize = gtk_mapserver_pack_finalize;
+}
+
+static void
+gtk_mapserver_pack_init (GtkMapserverPack *pack)
+{
+	GtkMapserverPackPrivate *priv = GTK_MAPSERVER_PACK_GET_PRIVATE (pack);
+
+	priv->mfile = NULL;
+	priv->bytes = NULL;
+	priv->data = NULL;
+	priv->length = 0;
+
+	priv->tile_size = 0;
+	priv->n_levels = 0;
+	priv->levels = NULL;
+	priv->n_tiles = 0;
+	priv->index = NULL;
+
+	priv->tiles = gtk_mapserver_cache_new (PACK_TILES_SIZE, 0);
+}
+
+GQuark
+gtk_mapserver_pack_error_quark (void)
+{
+	return g_quark_from_static_string ("gtk-mapserver-pack-error-quark");
+}
+
+/**
+ * gtk_mapserver_pack_new:
+ * @filename: a pack file created by the seeding tool.
+ * @error:
+ *
+ * Maps @filename in memory read-only; tiles are never copied until decoded.
+ *
+ * Returns: the new created #GtkMapserverPack object, or NULL on error.
+ */
+GtkMapserverPack
+*gtk_mapserver_pack_new (const gchar *filename, GError **error)
+{
+	GtkMapserverPack *pack;
+	GtkMapserverPackPrivate *priv;
+
+	const guchar *p;
+	guint level;
+	guint64 n_tiles;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	pack = GTK_MAPSERVER_PACK (g_object_new (gtk_mapserver_pack_get_type (), NULL));
+	priv = GTK_MAPSERVER_PACK_GET_PRIVATE (pack);
+
+	priv->mfile = g_mapped_file_new (filename, FALSE, error);
+	if (priv->mfile == NULL)
+		{
+			g_object_unref (pack);
+			return NULL;
+		}
+
+	priv->bytes = g_mapped_file_get_bytes (priv->mfile);
+	priv->data = g_bytes_get_data (priv->bytes, &priv->length);
+
+	p = priv->data;
+	if (priv->length < PACK_HEADER_SIZE
+		|| memcmp (p, PACK_MAGIC, 8) != 0)
+		{
+			g_set_error (error, GTK_MAPSERVER_PACK_ERROR, GTK_MAPSERVER_PACK_ERROR_FORMAT,
+						 "File '%s' is not a map pack.", filename);
+			g_object_unref (pack);
+			return NULL;
+		}
+	if (read_u32 (p + 8) != PACK_VERSION)
+		{
+			g_set_error (error, GTK_MAPSERVER_PACK_ERROR, GTK_MAPSERVER_PACK_ERROR_FORMAT,
+						 "Map pack '%s' has unsupported version %u.", filename, read_u32 (p + 8));
+			g_object_unref (pack);
+			return NULL;
+		}
+
+	priv->tile_size = read_u32 (p + 12);
+	priv->n_levels = read_u32 (p + 16);
+	priv->n_tiles = read_u64 (p + 24);
+	priv->ext.minx = read_double (p + 32);
+	priv->ext.miny = read_double (p + 40);
+	priv->ext.maxx = read_double (p + 48);
+	priv->ext.maxy = read_double (p + 56);
+
+	if (priv->tile_size == 0
+		|| priv->n_levels == 0
+		|| priv->n_levels > (priv->length - PACK_HEADER_SIZE) / PACK_LEVEL_SIZE
+		|| priv->n_tiles > (priv->length - PACK_HEADER_SIZE - priv->n_levels * PACK_LEVEL_SIZE) / PACK_INDEX_SIZE)
+		{
+			g_set_error (error, GTK_MAPSERVER_PACK_ERROR, GTK_MAPSERVER_PACK_ERROR_FORMAT,
+						 "Map pack '%s' is truncated.", filename);
+			g_object_unref (pack);
+			return NULL;
+		}
+
+	priv->levels = g_new0 (GtkMapserverPackLevel, priv->n_levels);
+
+	n_tiles = 0;
+	p = priv->data + PACK_HEADER_SIZE;
+	for (level = 0; level < priv->n_levels; level++)
+		{
+			priv->levels[level].scale = read_double (p);
+			priv->levels[level].cols = read_u32 (p + 8);
+			priv->levels[level].rows = read_u32 (p + 12);
+			priv->levels[level].first_tile = read_u64 (p + 16);
+
+			if (priv->levels[level].scale <= 0.0
+				|| priv->levels[level].first_tile != n_tiles)
+				{
+					g_set_error (error, GTK_MAPSERVER_PACK_ERROR, GTK_MAPSERVER_PACK_ERROR_FORMAT,
+								 "Map pack '%s' has a corrupted level table.", filename);
+					g_object_unref (pack);
+					return NULL;
+				}
+
+			n_tiles += (guint64)priv->levels[level].cols * priv->levels[level].rows;
+			p += PACK_LEVEL_SIZE;
+		}
+	if (n_tiles != priv->n_tiles)
+		{
+			g_set_error (error, GTK_MAPSERVER_PACK_ERROR, GTK_MAPSERVER_PACK_ERROR_FORMAT,
+						 "Map pack '%s' has a corrupted level table.", filename);
+			g_object_unref (pack);
+			return NULL;
+		}
+
+	priv->index = p;
+
+	return pack;
+}
+
+/**
+ * gtk_mapserver_pack_get_extent:
+ * @pack:
+ * @ext: (out): where to store the extent covered by @pack.
+ */
+void
+gtk_mapserver_pack_get_extent (GtkMapserverPack *pack, GtkMapserverExtent *ext)
+{
+	GtkMapserverPackPrivate *priv;
+
+	g_return_if_fail (GTK_IS_MAPSERVER_PACK (pack));
+	g_return_if_fail (ext != NULL);
+
+	priv = GTK_MAPSERVER_PACK_GET_PRIVATE (pack);
+
+	*ext = priv->ext;
+}
+
+/**
+ * gtk_mapserver_pack_get_tile_size:
+ * @pack:
+ *
+ * Returns: the side of the tiles, in pixels.
+ */
+guint
+gtk_mapserver_pack_get_tile_size (GtkMapserverPack *pack)
+{
+	g_return_val_if_fail (GTK_IS_MAPSERVER_PACK (pack), 0);
+
+	return GTK_MAPSERVER_PACK_GET_PRIVATE (pack)->tile_size;
+}
+
+/**
+ * gtk_mapserver_pack_get_n_levels:
+ * @pack:
+ *
+ * Returns: the number of scales stored in @pack.
+ */
+guint
+gtk_mapserver_pack_get_n_levels (GtkMapserverPack *pack)
+{
+	g_return_val_if_fail (GTK_IS_MAPSERVER_PACK (pack), 0);
+
+	return GTK_MAPSERVER_PACK_GET_PRIVATE (pack)->n_levels;
+}
+
+/**
+ * gtk_mapserver_pack_get_level_scale:
+ * @pack:
+ * @level:
+ *
+ * Returns: the scale of @level, in map units per pixel.
+ */
+gdouble
+gtk_mapserver_pack_get_level_scale (GtkMapserverPack *pack, guint level)
+{
+	GtkMapserverPackPrivate *priv;
+
+	g_return_val_if_fail (GTK_IS_MAPSERVER_PACK (pack), 0.0);
+
+	priv = GTK_MAPSERVER_PACK_GET_PRIVATE (pack);
+
+	g_return_val_if_fail (level < priv->n_levels, 0.0);
+
+	return priv->levels[level].scale;
+}
+
+/**
+ * gtk_mapserver_pack_lookup:
+ * @pack:
+ * @level:
+ * @col:
+ * @row:
+ *
+ * Returns: the encoded image of the tile, pointing straight into the
+ * mapped file; NULL if the tile is outside the pack or was not seeded.
+ */
+GBytes
+*gtk_mapserver_pack_lookup (GtkMapserverPack *pack, guint level, guint col, guint row)
+{
+	GtkMapserverPackPrivate *priv;
+	GtkMapserverPackLevel *lvl;
+
+	const guchar *entry;
+	guint64 offset;
+	guint32 length;
+
+	g_return_val_if_fail (GTK_IS_MAPSERVER_PACK (pack), NULL);
+
+	priv = GTK_MAPSERVER_PACK_GET_PRIVATE (pack);
+
+	if (level >= priv->n_levels)
+		{
+			return NULL;
+		}
+
+	lvl = &priv->levels[level];
+	if (col >= lvl->cols || row >= lvl->rows)
+		{
+			return NULL;
+		}
+
+	entry = priv->index + (lvl->first_tile + (guint64)row * lvl->cols + col) * PACK_INDEX_SIZE;
+	offset = read_u64 (entry);
+	length = read_u32 (entry + 8);
+
+	if (length == 0
+		|| offset > priv->length
+		|| length > priv->length - offset)
+		{
+			return NULL;
+		}
+
+	return g_bytes_new_from_bytes (priv->bytes, offset, length);
+}
+
+static GdkPixbuf
+*gtk_mapserver_pack_decode (GBytes *bytes)
+{
+	GdkPixbuf *ret;
+	GdkPixbufLoader *pxb_loader;
+	GError *error;
+
+	gconstpointer data;
+	gsize length;
+
+	ret = NULL;
+
+	data = g_bytes_get_data (bytes, &length);
+
+	error = NULL;
+	pxb_loader = gdk_pixbuf_loader_new ();
+	if (gdk_pixbuf_loader_write (pxb_loader, data, length, &error)
+		&& gdk_pixbuf_loader_close (pxb_loader, &error))
+		{
+			ret = g_object_ref (gdk_pixbuf_loader_get_pixbuf (pxb_loader));
+		}
+	else
+		{
+			g_warning ("Error on decoding pack tile: %s.",
+					   error != NULL && error->message != NULL ? error->message : "no details");
+			g_clear_error (&error);
+			gdk_pixbuf_loader_close (pxb_loader, NULL);
+		}
+	g_object_unref (pxb_loader);
+
+	return ret;
+}
+
+/**
+ * gtk_mapserver_pack_render:
+ * @pack:
+ * @ext: the extent to render.
+ * @width:
+ * @height:
+ *
+ * Composes the tiles of the level nearest to the requested scale. The
+ * last tiles decoded are kept, so renders of nearby extents decode only
+ * what they newly cover; call it from one thread only.
+ *
+ * Returns: a new #GdkPixbuf of @width x @height pixels.
+ */
+GdkPixbuf
+*gtk_mapserver_pack_render (GtkMapserverPack *pack,
+							const GtkMapserverExtent *ext,
+							gint width,
+							gint height)
+{
+	GtkMapserverPackPrivate *priv;
+	GtkMapserverPackLevel *lvl;
+	GdkPixbuf *ret;
+
+	gdouble cx;
+	gdouble cy;
+	gdouble ratio;
+	gdouble best_ratio;
+	gdouble span;
+	guint level;
+	gint col;
+	gint row;
+	gint col_start;
+	gint col_end;
+	gint row_start;
+	gint row_end;
+
+	g_return_val_if_fail (GTK_IS_MAPSERVER_PACK (pack), NULL);
+	g_return_val_if_fail (ext != NULL, NULL);
+	g_return_val_if_fail (width > 0 && height > 0, NULL);
+
+	priv = GTK_MAPSERVER_PACK_GET_PRIVATE (pack);
+
+	ret = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width, height);
+	gdk_pixbuf_fill (ret, 0x00000000);
+
+	cx = (ext->maxx - ext->minx) / width;
+	cy = (ext->maxy - ext->miny) / height;
+	if (cx <= 0.0 || cy <= 0.0)
+		{
+			return ret;
+		}
+
+	lvl = &priv->levels[0];
+	best_ratio = G_MAXDOUBLE;
+	for (level = 0; level < priv->n_levels; level++)
+		{
+			ratio = priv->levels[level].scale > cx
+					? priv->levels[level].scale / cx
+					: cx / priv->levels[level].scale;
+			if (ratio < best_ratio)
+				{
+					best_ratio = ratio;
+					lvl = &priv->levels[level];
+				}
+		}
+
+	span = lvl->scale * priv->tile_size;
+
+	col_start = MAX (0, (gint)floor ((ext->minx - priv->ext.minx) / span));
+	col_end = MIN ((gint)lvl->cols - 1, (gint)floor ((ext->maxx - priv->ext.minx) / span));
+	row_start = MAX (0, (gint)floor ((priv->ext.maxy - ext->maxy) / span));
+	row_end = MIN ((gint)lvl->rows - 1, (gint)floor ((priv->ext.maxy - ext->miny) / span));
+
+	for (row = row_start; row <= row_end; row++)
+		{
+			for (col = col_start; col <= col_end; col++)
+				{
+					GBytes *bytes;
+					GdkPixbuf *tile;
+					gchar *key;
+
+					gdouble offset_x;
+					gdouble offset_y;
+					gdouble scale_x;
+					gdouble scale_y;
+					gint dest_x;
+					gint dest_y;
+					gint dest_x_end;
+					gint dest_y_end;
+
+					key = g_strdup_printf ("%u:%d:%d", (guint)(lvl - priv->levels), col, row);
+					tile = gtk_mapserver_cache_lookup_pixbuf (priv->tiles, key);
+					if (tile != NULL)
+						{
+							g_object_ref (tile);
+						}
+					else
+						{
+							bytes = gtk_mapserver_pack_lookup (pack, lvl - priv->levels, col, row);
+							if (bytes != NULL)
+								{
+									tile = gtk_mapserver_pack_decode (bytes);
+									g_bytes_unref (bytes);
+								}
+							if (tile != NULL)
+								{
+									gtk_mapserver_cache_insert (priv->tiles, key, NULL, tile);
+								}
+						}
+					g_free (key);
+					if (tile == NULL)
+						{
+							continue;
+						}
+
+					scale_x = span / gdk_pixbuf_get_width (tile) / cx;
+					scale_y = span / gdk_pixbuf_get_height (tile) / cy;
+					offset_x = (priv->ext.minx + col * span - ext->minx) / cx;
+					offset_y = (ext->maxy - (priv->ext.maxy - row * span)) / cy;
+
+					dest_x = MAX (0, (gint)floor (offset_x));
+					dest_y = MAX (0, (gint)floor (offset_y));
+					dest_x_end = MIN (width, (gint)ceil (offset_x + span / cx));
+					dest_y_end = MIN (height, (gint)ceil (offset_y + span / cy));
+
+					if (dest_x_end > dest_x && dest_y_end > dest_y)
+						{
+							gdk_pixbuf_composite (tile, ret,
+												  dest_x, dest_y,
+												  dest_x_end - dest_x, dest_y_end - dest_y,
+												  offset_x, offset_y,
+												  scale_x, scale_y,
+												  GDK_INTERP_BILINEAR, 255);
+						}
+
+					g_object_unref (tile);
+				}
+		}
+
+	return ret;
+}
+
+static void
+gtk_mapserver_pack_finalize (GObject *object)
+{
+	GtkMapserverPackPrivate *priv = GTK_MAPSERVER_PACK_GET_PRIVATE (object);
+
+	if (priv->bytes != NULL)
+		{
+			g_bytes_unref (priv->bytes);
+		}
+	if (priv->mfile != NULL)
+		{
+			g_mapped_file_unref (priv->mfile);
+		}
+	g_free (priv->levels);
+	gtk_mapserver_cache_free (priv->tiles);
+
+	G_OBJECT_CLASS (gtk_mapserver_pack_parent_class)->finalize (object);
+}
+
+/* WRITER */
+static void
+gtk_mapserver_pack_writer_free (GtkMapserverPackWriter *writer)
+{
+	if (writer->stream != NULL)
+		{
+			g_object_unref (writer->stream);
+		}
+	g_mutex_clear (&writer->mutex);
+	g_free (writer->levels);
+	g_free (writer->index);
+	g_free (writer);
+}
+
+/**
+ * gtk_mapserver_pack_writer_new:
+ * @filename:
+ * @ext: the extent to seed.
+ * @tile_size: the side of the tiles, in pixels.
+ * @scales: the scales to seed, in map units per pixel.
+ * @n_scales:
+ * @error:
+ *
+ * Returns: a new #GtkMapserverPackWriter; tiles can be added from any thread.
+ */
+GtkMapserverPackWriter
+*gtk_mapserver_pack_writer_new (const gchar *filename,
+								const GtkMapserverExtent *ext,
+								guint tile_size,
+								const gdouble *scales,
+								guint n_scales,
+								GError **error)
+{
+	GtkMapserverPackWriter *writer;
+	GFile *file;
+
+	guint level;
+	gdouble span;
+	goffset data_start;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+	g_return_val_if_fail (ext != NULL, NULL);
+	g_return_val_if_fail (ext->maxx > ext->minx && ext->maxy > ext->miny, NULL);
+	g_return_val_if_fail (tile_size > 0, NULL);
+	g_return_val_if_fail (scales != NULL && n_scales > 0, NULL);
+
+	writer = g_new0 (GtkMapserverPackWriter, 1);
+	g_mutex_init (&writer->mutex);
+
+	writer->ext = *ext;
+	writer->tile_size = tile_size;
+	writer->n_levels = n_scales;
+	writer->levels = g_new0 (GtkMapserverPackLevel, n_scales);
+
+	writer->n_tiles = 0;
+	for (level = 0; level < n_scales; level++)
+		{
+			if (scales[level] <= 0.0)
+				{
+					g_set_error (error, GTK_MAPSERVER_PACK_ERROR, GTK_MAPSERVER_PACK_ERROR_RANGE,
+								 "Invalid scale %f.", scales[level]);
+					gtk_mapserver_pack_writer_free (writer);
+					return NULL;
+				}
+
+			span = scales[level] * tile_size;
+
+			writer->levels[level].scale = scales[level];
+			writer->levels[level].cols = MAX (1, (guint)ceil ((ext->maxx - ext->minx) / span));
+			writer->levels[level].rows = MAX (1, (guint)ceil ((ext->maxy - ext->miny) / span));
+			writer->levels[level].first_tile = writer->n_tiles;
+
+			writer->n_tiles += (guint64)writer->levels[level].cols * writer->levels[level].rows;
+		}
+
+	writer->index = g_try_malloc0 (writer->n_tiles * PACK_INDEX_SIZE);
+	if (writer->index == NULL)
+		{
+			g_set_error (error, GTK_MAPSERVER_PACK_ERROR, GTK_MAPSERVER_PACK_ERROR_RANGE,
+						 "Too many tiles (%" G_GUINT64_FORMAT ").", writer->n_tiles);
+			gtk_mapserver_pack_writer_free (writer);
+			return NULL;
+		}
+
+	file = g_file_new_for_path (filename);
+	writer->stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, NULL, error);
+	g_object_unref (file);
+	if (writer->stream == NULL)
+		{
+			gtk_mapserver_pack_writer_free (writer);
+			return NULL;
+		}
+
+	/* leave room for header and index, filled in on close */
+	data_start = PACK_HEADER_SIZE
+				 + writer->n_levels * PACK_LEVEL_SIZE
+				 + writer->n_tiles * PACK_INDEX_SIZE;
+	data_start = (data_start + PACK_DATA_ALIGN - 1) / PACK_DATA_ALIGN * PACK_DATA_ALIGN;
+
+	if (!g_seekable_seek (G_SEEKABLE (writer->stream), data_start, G_SEEK_SET, NULL, error))
+		{
+			gtk_mapserver_pack_writer_free (writer);
+			return NULL;
+		}
+	writer->pos = data_start;
+
+	return writer;
+}
+
+/**
+ * gtk_mapserver_pack_writer_get_grid:
+ * @writer:
+ * @level:
+ * @cols: (out):
+ * @rows: (out):
+ */
+void
+gtk_mapserver_pack_writer_get_grid (GtkMapserverPackWriter *writer,
+									guint level,
+									guint *cols,
+									guint *rows)
+{
+	g_return_if_fail (writer != NULL);
+	g_return_if_fail (level < writer->n_levels);
+
+	if (cols != NULL)
+		{
+			*cols = writer->levels[level].cols;
+		}
+	if (rows != NULL)
+		{
+			*rows = writer->levels[level].rows;
+		}
+}
+
+/**
+ * gtk_mapserver_pack_writer_get_tile_extent:
+ * @writer:
+ * @level:
+ * @col:
+ * @row:
+ * @ext: (out): where to store the extent of the tile.
+ */
+void
+gtk_mapserver_pack_writer_get_tile_extent (GtkMapserverPackWriter *writer,
+										   guint level,
+										   guint col,
+										   guint row,
+										   GtkMapserverExtent *ext)
+{
+	gdouble span;
+
+	g_return_if_fail (writer != NULL);
+	g_return_if_fail (level < writer->n_levels);
+	g_return_if_fail (ext != NULL);
+
+	span = writer->levels[level].scale * writer->tile_size;
+
+	ext->minx = writer->ext.minx + col * span;
+	ext->maxx = ext->minx + span;
+	ext->maxy = writer->ext.maxy - row * span;
+	ext->miny = ext->maxy - span;
+}
+
+/**
+ * gtk_mapserver_pack_writer_add_tile:
+ * @writer:
+ * @level:
+ * @col:
+ * @row:
+ * @data: the encoded tile image.
+ * @length:
+ * @error:
+ *
+ * Appends a tile to the data section; safe to call from several threads.
+ *
+ * Returns: TRUE on success.
+ */
+gboolean
+gtk_mapserver_pack_writer_add_tile (GtkMapserverPackWriter *writer,
+									guint level,
+									guint col,
+									guint row,
+									const guchar *data,
+									gsize length,
+									GError **error)
+{
+	static const guchar padding[8] = { 0 };
+
+	GtkMapserverPackLevel *lvl;
+	guchar *entry;
+	gsize pad;
+	gboolean ret;
+
+	g_return_val_if_fail (writer != NULL, FALSE);
+	g_return_val_if_fail (data != NULL || length == 0, FALSE);
+
+	if (level >= writer->n_levels
+		|| col >= writer->levels[level].cols
+		|| row >= writer->levels[level].rows)
+		{
+			g_set_error (error, GTK_MAPSERVER_PACK_ERROR, GTK_MAPSERVER_PACK_ERROR_RANGE,
+						 "Tile %u/%u/%u is outside the pack.", level, col, row);
+			return FALSE;
+		}
+	if (length > G_MAXUINT32)
+		{
+			g_set_error (error, GTK_MAPSERVER_PACK_ERROR, GTK_MAPSERVER_PACK_ERROR_RANGE,
+						 "Tile %u/%u/%u is too big.", level, col, row);
+			return FALSE;
+		}
+
+	lvl = &writer->levels[level];
+	pad = (8 - length % 8) % 8;
+
+	g_mutex_lock (&writer->mutex);
+
+	ret = g_output_stream_write_all (G_OUTPUT_STREAM (writer->stream), data, length, NULL, NULL, error)
+		  && g_output_stream_write_all (G_OUTPUT_STREAM (writer->stream), padding, pad, NULL, NULL, error);
+	if (ret)
+		{
+			entry = writer->index + (lvl->first_tile + (guint64)row * lvl->cols + col) * PACK_INDEX_SIZE;
+			write_u64 (entry, writer->pos);
+			write_u32 (entry + 8, length);
+			writer->pos += length + pad;
+		}
+
+	g_mutex_unlock (&writer->mutex);
+
+	return ret;
+}
+
+/**
+ * gtk_mapserver_pack_writer_close:
+ * @writer:
+ * @error:
+ *
+ * Writes header and index and frees @writer.
+ *
+ * Returns: TRUE on success.
+ */
+gboolean
+gtk_mapserver_pack_writer_close (GtkMapserverPackWriter *writer, GError **error)
+{
+	guchar *header;
+	gsize header_size;
+	guint level;
+	gboolean ret;
+
+	g_return_val_if_fail (writer != NULL, FALSE);
+
+	header_size = PACK_HEADER_SIZE + writer->n_levels * PACK_LEVEL_SIZE;
+	header = g_malloc0 (header_size);
+
+	memcpy (header, PACK_MAGIC, 8);
+	write_u32 (header + 8, PACK_VERSION);
+	write_u32 (header + 12, writer->tile_size);
+	write_u32 (header + 16, writer->n_levels);
+	write_u64 (header + 24, writer->n_tiles);
+	write_double (header + 32, writer->ext.minx);
+	write_double (header + 40, writer->ext.miny);
+	write_double (header + 48, writer->ext.maxx);
+	write_double (header + 56, writer->ext.maxy);
+
+	for (level = 0; level < writer->n_levels; level++)
+		{
+			guchar *p = header + PACK_HEADER_SIZE + level * PACK_LEVEL_SIZE;
+
+			write_double (p, writer->levels[level].scale);
+			write_u32 (p + 8, writer->levels[level].cols);
+			write_u32 (p + 12, writer->levels[level].rows);
+			write_u64 (p + 16, writer->levels[level].first_tile);
+		}
+
+	ret = g_seekable_seek (G_SEEKABLE (writer->stream), 0, G_SEEK_SET, NULL, error)
+		  && g_output_stream_write_all (G_OUTPUT_STREAM (writer->stream), header, header_size, NULL, NULL, error)
+		  && g_output_stream_write_all (G_OUTPUT_STREAM (writer->stream), writer->index, writer->n_tiles * PACK_INDEX_SIZE, NULL, NULL, error)
+		  && g_output_stream_close (G_OUTPUT_STREAM (writer->stream), NULL, error);
+
+	g_free (header);
+	gtk_mapserver_pack_writer_free (writer);
+
+	return ret;
+}
@@ -0,0 +1,119 @@
+/*
+ *  gtkmapserverpack.h
+ *
+ *  Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This file is part of libgtkmapserver.
+ *
+ *  libgtkmapserver is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libgtkmapserver is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libgtkmapserver; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __GTK_MAPSERVER_PACK_H__
+#define __GTK_MAPSERVER_PACK_H__
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "gtkmapserver.h"
+
+
+G_BEGIN_DECLS
+
+
+#define GTK_TYPE_MAPSERVER_PACK                 (gtk_mapserver_pack_get_type ())
+#define GTK_MAPSERVER_PACK(obj)                 (G_TYPE_CHECK_INSTANCE_CAST ((obj), GTK_TYPE_MAPSERVER_PACK, GtkMapserverPack))
+#define GTK_MAPSERVER_PACK_CLASS(klass)         (G_TYPE_CHECK_CLASS_CAST ((klass), GTK_TYPE_MAPSERVER_PACK, GtkMapserverPackClass))
+#define GTK_IS_MAPSERVER_PACK(obj)              (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GTK_TYPE_MAPSERVER_PACK))
+#define GTK_IS_MAPSERVER_PACK_CLASS(klass)      (G_TYPE_CHECK_CLASS_TYPE ((klass), GTK_TYPE_MAPSERVER_PACK))
+#define GTK_MAPSERVER_PACK_GET_CLASS(obj)       (G_TYPE_INSTANCE_GET_CLASS ((obj), GTK_TYPE_MAPSERVER_PACK, GtkMapserverPackClass))
+
+
+typedef struct _GtkMapserverPack GtkMapserverPack;
+typedef struct _GtkMapserverPackClass GtkMapserverPackClass;
+
+struct _GtkMapserverPack
+	{
+		GObject parent;
+	};
+
+struct _GtkMapserverPackClass
+	{
+		GObjectClass parent_class;
+	};
+
+GType gtk_mapserver_pack_get_type (void) G_GNUC_CONST;
+
+
+#define GTK_MAPSERVER_PACK_ERROR gtk_mapserver_pack_error_quark ()
+
+typedef enum
+	{
+		GTK_MAPSERVER_PACK_ERROR_FORMAT,
+		GTK_MAPSERVER_PACK_ERROR_RANGE
+	} GtkMapserverPackError;
+
+GQuark gtk_mapserver_pack_error_quark (void);
+
+
+GtkMapserverPack *gtk_mapserver_pack_new (const gchar *filename, GError **error);
+
+void gtk_mapserver_pack_get_extent (GtkMapserverPack *pack, GtkMapserverExtent *ext);
+guint gtk_mapserver_pack_get_tile_size (GtkMapserverPack *pack);
+guint gtk_mapserver_pack_get_n_levels (GtkMapserverPack *pack);
+gdouble gtk_mapserver_pack_get_level_scale (GtkMapserverPack *pack, guint level);
+
+GBytes *gtk_mapserver_pack_lookup (GtkMapserverPack *pack, guint level, guint col, guint row);
+
+GdkPixbuf *gtk_mapserver_pack_render (GtkMapserverPack *pack,
+									  const GtkMapserverExtent *ext,
+									  gint width,
+									  gint height);
+
+
+typedef struct _GtkMapserverPackWriter GtkMapserverPackWriter;
+
+GtkMapserverPackWriter *gtk_mapserver_pack_writer_new (const gchar *filename,
+													   const GtkMapserverExtent *ext,
+													   guint tile_size,
+													   const gdouble *scales,
+													   guint n_scales,
+													   GError **error);
+
+void gtk_mapserver_pack_writer_get_grid (GtkMapserverPackWriter *writer,
+										 guint level,
+										 guint *cols,
+										 guint *rows);
+void gtk_mapserver_pack_writer_get_tile_extent (GtkMapserverPackWriter *writer,
+												guint level,
+												guint col,
+												guint row,
+												GtkMapserverExtent *ext);
+
+gboolean gtk_mapserver_pack_writer_add_tile (GtkMapserverPackWriter *writer,
+											 guint level,
+											 guint col,
+											 guint row,
+											 const guchar *data,
+											 gsize length,
+											 GError **error);
+
+gboolean gtk_mapserver_pack_writer_close (GtkMapserverPackWriter *writer, GError **error);
+
+
+G_END_DECLS
+
+#endif /* __GTK_MAPSERVER_PACK_H__ */
@@ -0,0 +1,5 @@
+#!/bin/sh
+# Replays the sample trace against the stand-in server: every drag in it
+# must reach the map and cost requests. Exits 77 without a display.
+
+exec ./bench -p "${srcdir:-.}/sample.trace" -s 4 --check -o /dev/null
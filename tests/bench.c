@@ -0,0 +1,1081 @@
+/*
+ * Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Records the interactions with a GtkMapserver as a timestamped trace, and
+ * replays it offscreen against the local stand-in server, once for every
+ * configuration given. For each interaction it reports the requests and
+ * bytes it cost the server, the cache lookups and hits, and the time from
+ * its last event to the image on screen, as a JSON document.
+ *
+ *   bench -r session.trace
+ *   bench -p session.trace -c "" -c "split=4" -c "context.l1-size=0" -o out.json
+ *
+ * A trace is a text file: a header of "# home minx miny maxx maxy" and
+ * "# size width height", then one event per line, milliseconds first:
+ *
+ *   1532 key plus 0
+ *   2010 press 1 320.0 240.0
+ *   2050 motion 330.0 245.0
+ *   2300 release 1 400.0 260.0
+ *   4100 resize 800 600
+ *
+ * Key events carry the key name and the modifier state. With --check the
+ * replay fails if a drag made no request of the server.
+ *
+ * Exits with 77, the automake code for a skipped test, without a display.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtkmapserver.h"
+#include "mapservstub.h"
+
+#define TIMEOUT 10
+
+typedef enum
+	{
+		BENCH_RESIZE,
+		BENCH_KEY,
+		BENCH_PRESS,
+		BENCH_MOTION,
+		BENCH_RELEASE
+	} BenchEventType;
+
+typedef struct
+	{
+		guint time;
+		BenchEventType type;
+		guint keyval;
+		guint state;
+		guint button;
+		gdouble x;
+		gdouble y;
+		gint width;
+		gint height;
+	} BenchEvent;
+
+typedef struct
+	{
+		GtkMapserverExtent home;
+		gint width;
+		gint height;
+		GArray *events;
+	} BenchTrace;
+
+typedef struct
+	{
+		guint requests;
+		guint64 bytes;
+		guint64 lookups;
+		guint64 hits;
+	} BenchCounts;
+
+typedef struct
+	{
+		const gchar *type;
+		gchar *detail;
+		gdouble start;
+		gdouble end;
+		BenchCounts at_start;
+		BenchCounts counts;
+		gdouble time_to_visible;
+	} BenchInteraction;
+
+typedef struct
+	{
+		MapservStub *stub;
+		GtkMapserverContext *ctx;
+		GtkWidget *gtkm;
+		gint64 start;
+		GArray *interactions;
+		gint awaiting;
+		gboolean rendered;
+	} BenchRun;
+
+/* RECORD */
+
+static FILE *record_file;
+static gint64 record_start;
+static gint record_width = -1;
+static gint record_height = -1;
+
+static void
+record_event (const gchar *format, ...)
+{
+	va_list args;
+
+	fprintf (record_file, "%u ", (guint)((g_get_monotonic_time () - record_start) / 1000));
+
+	va_start (args, format);
+	vfprintf (record_file, format, args);
+	va_end (args);
+
+	fputc ('\n', record_file);
+	fflush (record_file);
+}
+
+/* the locale of the display may want a decimal comma */
+static gchar
+*record_double (gchar *buffer, gdouble value)
+{
+	return g_ascii_formatd (buffer, G_ASCII_DTOSTR_BUF_SIZE, "%.1f", value);
+}
+
+static gboolean
+on_record_key_release (GtkWidget *widget, GdkEventKey *event, gpointer user_data)
+{
+	const gchar *name;
+
+	name = gdk_keyval_name (event->keyval);
+	if (name != NULL)
+		{
+			record_event ("key %s %u", name, event->state & gtk_accelerator_get_default_mod_mask ());
+		}
+
+	return FALSE;
+}
+
+static gboolean
+on_record_button (GtkWidget *widget, GdkEventButton *event, gpointer user_data)
+{
+	gchar x[G_ASCII_DTOSTR_BUF_SIZE];
+	gchar y[G_ASCII_DTOSTR_BUF_SIZE];
+
+	if (event->type == GDK_BUTTON_PRESS || event->type == GDK_BUTTON_RELEASE)
+		{
+			record_event ("%s %u %s %s",
+						  event->type == GDK_BUTTON_PRESS ? "press" : "release",
+						  event->button,
+						  record_double (x, event->x),
+						  record_double (y, event->y));
+		}
+
+	return FALSE;
+}
+
+static gboolean
+on_record_motion (GtkWidget *widget, GdkEventMotion *event, gpointer user_data)
+{
+	gchar x[G_ASCII_DTOSTR_BUF_SIZE];
+	gchar y[G_ASCII_DTOSTR_BUF_SIZE];
+
+	/* only drags move the map */
+	if (event->state & GDK_BUTTON1_MASK)
+		{
+			record_event ("motion %s %s",
+						  record_double (x, event->x),
+						  record_double (y, event->y));
+		}
+
+	return FALSE;
+}
+
+static void
+on_record_size_allocate (GtkWidget *widget, GdkRectangle *allocation, gpointer user_data)
+{
+	if (allocation->width == record_width && allocation->height == record_height)
+		{
+			return;
+		}
+
+	if (record_width < 0)
+		{
+			/* the first allocation is the size the replay starts at */
+			fprintf (record_file, "# size %d %d\n", allocation->width, allocation->height);
+			fflush (record_file);
+		}
+	else
+		{
+			record_event ("resize %d %d", allocation->width, allocation->height);
+		}
+
+	record_width = allocation->width;
+	record_height = allocation->height;
+}
+
+static gint
+record (const gchar *filename, const gchar *url, GtkMapserverExtent *home, guint latency)
+{
+	GtkWidget *window;
+	GtkWidget *gtkm;
+	MapservStub *stub;
+	GError *error;
+	gchar minx[G_ASCII_DTOSTR_BUF_SIZE];
+	gchar miny[G_ASCII_DTOSTR_BUF_SIZE];
+	gchar maxx[G_ASCII_DTOSTR_BUF_SIZE];
+	gchar maxy[G_ASCII_DTOSTR_BUF_SIZE];
+
+	stub = NULL;
+	if (url == NULL)
+		{
+			error = NULL;
+			stub = mapserv_stub_new (latency, &error);
+			if (stub == NULL)
+				{
+					g_printerr ("%s\n", error->message);
+					return 1;
+				}
+			url = mapserv_stub_get_url (stub);
+		}
+
+	record_file = fopen (filename, "w");
+	if (record_file == NULL)
+		{
+			g_printerr ("Unable to write %s.\n", filename);
+			return 1;
+		}
+	fprintf (record_file, "# gtkmapserver trace\n# home %s %s %s %s\n",
+			 g_ascii_dtostr (minx, sizeof (minx), home->minx),
+			 g_ascii_dtostr (miny, sizeof (miny), home->miny),
+			 g_ascii_dtostr (maxx, sizeof (maxx), home->maxx),
+			 g_ascii_dtostr (maxy, sizeof (maxy), home->maxy));
+
+	window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_default_size (GTK_WINDOW (window), 640, 480);
+	gtk_window_set_title (GTK_WINDOW (window), "Recording, close to stop");
+	g_signal_connect (window, "destroy", G_CALLBACK (gtk_main_quit), NULL);
+
+	gtkm = gtk_mapserver_new ();
+	g_signal_connect (gtkm, "key-release-event", G_CALLBACK (on_record_key_release), NULL);
+	g_signal_connect (gtkm, "button-press-event", G_CALLBACK (on_record_button), NULL);
+	g_signal_connect (gtkm, "button-release-event", G_CALLBACK (on_record_button), NULL);
+	g_signal_connect (gtkm, "motion-notify-event", G_CALLBACK (on_record_motion), NULL);
+	g_signal_connect (gtkm, "size-allocate", G_CALLBACK (on_record_size_allocate), NULL);
+	gtk_container_add (GTK_CONTAINER (window), gtkm);
+
+	record_start = g_get_monotonic_time ();
+	gtk_widget_show_all (window);
+	gtk_mapserver_set_home (GTK_MAPSERVER (gtkm), url, home);
+
+	gtk_main ();
+
+	fclose (record_file);
+	if (stub != NULL)
+		{
+			mapserv_stub_free (stub);
+		}
+
+	return 0;
+}
+
+/* REPLAY */
+
+static gboolean
+trace_parse_event (gchar **tokens, BenchEvent *event)
+{
+	guint n;
+
+	n = g_strv_length (tokens);
+	if (n < 2)
+		{
+			return FALSE;
+		}
+
+	memset (event, 0, sizeof (BenchEvent));
+	event->time = g_ascii_strtoull (tokens[0], NULL, 10);
+
+	if (g_strcmp0 (tokens[1], "key") == 0 && n == 4)
+		{
+			event->type = BENCH_KEY;
+			event->keyval = gdk_keyval_from_name (tokens[2]);
+			event->state = g_ascii_strtoull (tokens[3], NULL, 10);
+			return event->keyval != GDK_KEY_VoidSymbol;
+		}
+	if ((g_strcmp0 (tokens[1], "press") == 0 || g_strcmp0 (tokens[1], "release") == 0) && n == 5)
+		{
+			event->type = tokens[1][0] == 'p' ? BENCH_PRESS : BENCH_RELEASE;
+			event->button = g_ascii_strtoull (tokens[2], NULL, 10);
+			event->x = g_ascii_strtod (tokens[3], NULL);
+			event->y = g_ascii_strtod (tokens[4], NULL);
+			return TRUE;
+		}
+	if (g_strcmp0 (tokens[1], "motion") == 0 && n == 4)
+		{
+			event->type = BENCH_MOTION;
+			event->x = g_ascii_strtod (tokens[2], NULL);
+			event->y = g_ascii_strtod (tokens[3], NULL);
+			return TRUE;
+		}
+	if (g_strcmp0 (tokens[1], "resize") == 0 && n == 4)
+		{
+			event->type = BENCH_RESIZE;
+			event->width = atoi (tokens[2]);
+			event->height = atoi (tokens[3]);
+			return event->width > 0 && event->height > 0;
+		}
+
+	return FALSE;
+}
+
+static BenchTrace
+*trace_load (const gchar *filename, GError **error)
+{
+	BenchTrace *trace;
+	BenchEvent event;
+	gchar *contents;
+	gchar **lines;
+	gchar **tokens;
+	guint i;
+
+	if (!g_file_get_contents (filename, &contents, NULL, error))
+		{
+			return NULL;
+		}
+
+	trace = g_new0 (BenchTrace, 1);
+	trace->home.maxx = 1000.0;
+	trace->home.maxy = 1000.0;
+	trace->width = 640;
+	trace->height = 480;
+	trace->events = g_array_new (FALSE, FALSE, sizeof (BenchEvent));
+
+	lines = g_strsplit (contents, "\n", -1);
+	g_free (contents);
+	for (i = 0; lines[i] != NULL; i++)
+		{
+			g_strstrip (lines[i]);
+			if (lines[i][0] == '\0')
+				{
+					continue;
+				}
+
+			tokens = g_strsplit_set (lines[i][0] == '#' ? lines[i] + 1 : lines[i], " \t", -1);
+			if (lines[i][0] == '#')
+				{
+					if (g_strv_length (tokens) == 6 && g_strcmp0 (tokens[1], "home") == 0)
+						{
+							trace->home.minx = g_ascii_strtod (tokens[2], NULL);
+							trace->home.miny = g_ascii_strtod (tokens[3], NULL);
+							trace->home.maxx = g_ascii_strtod (tokens[4], NULL);
+							trace->home.maxy = g_ascii_strtod (tokens[5], NULL);
+						}
+					else if (g_strv_length (tokens) == 4 && g_strcmp0 (tokens[1], "size") == 0)
+						{
+							trace->width = MAX (1, atoi (tokens[2]));
+							trace->height = MAX (1, atoi (tokens[3]));
+						}
+				}
+			else if (trace_parse_event (tokens, &event))
+				{
+					g_array_append_val (trace->events, event);
+				}
+			else
+				{
+					g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+								 "%s:%u: unknown event \"%s\".", filename, i + 1, lines[i]);
+					g_strfreev (tokens);
+					g_strfreev (lines);
+					g_array_free (trace->events, TRUE);
+					g_free (trace);
+					return NULL;
+				}
+			g_strfreev (tokens);
+		}
+	g_strfreev (lines);
+
+	return trace;
+}
+
+static void
+trace_free (BenchTrace *trace)
+{
+	g_array_free (trace->events, TRUE);
+	g_free (trace);
+}
+
+static gboolean
+set_property_from_string (GObject *object, const gchar *name, const gchar *str, GError **error)
+{
+	GParamSpec *pspec;
+	GValue value = G_VALUE_INIT;
+	gchar *end;
+
+	pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (object), name);
+	if (pspec == NULL || !(pspec->flags & G_PARAM_WRITABLE))
+		{
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+						 "%s has no writable property \"%s\".", G_OBJECT_TYPE_NAME (object), name);
+			return FALSE;
+		}
+
+	g_value_init (&value, pspec->value_type);
+	end = NULL;
+	switch (G_TYPE_FUNDAMENTAL (pspec->value_type))
+		{
+			case G_TYPE_BOOLEAN:
+				g_value_set_boolean (&value, g_ascii_strcasecmp (str, "true") == 0 || g_strcmp0 (str, "1") == 0);
+				end = (gchar *)str + strlen (str);
+				break;
+
+			case G_TYPE_INT:
+				g_value_set_int (&value, g_ascii_strtoll (str, &end, 10));
+				break;
+
+			case G_TYPE_UINT:
+				g_value_set_uint (&value, g_ascii_strtoull (str, &end, 10));
+				break;
+
+			case G_TYPE_UINT64:
+				g_value_set_uint64 (&value, g_ascii_strtoull (str, &end, 10));
+				break;
+
+			case G_TYPE_DOUBLE:
+				g_value_set_double (&value, g_ascii_strtod (str, &end));
+				break;
+
+			case G_TYPE_STRING:
+				g_value_set_string (&value, str);
+				end = (gchar *)str + strlen (str);
+				break;
+		}
+
+	if (end == NULL || end == str || *end != '\0')
+		{
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+						 "Invalid value \"%s\" for \"%s\".", str, name);
+			g_value_unset (&value);
+			return FALSE;
+		}
+
+	g_object_set_property (object, name, &value);
+	g_value_unset (&value);
+
+	return TRUE;
+}
+
+/* "name=value,context.name=value": properties of the map or of its context */
+static gboolean
+apply_config (BenchRun *run, const gchar *config, GError **error)
+{
+	gchar **settings;
+	gchar **pair;
+	gboolean ok;
+	guint i;
+
+	ok = TRUE;
+	settings = g_strsplit (config, ",", -1);
+	for (i = 0; settings[i] != NULL && ok; i++)
+		{
+			g_strstrip (settings[i]);
+			if (settings[i][0] == '\0')
+				{
+					continue;
+				}
+
+			pair = g_strsplit (settings[i], "=", 2);
+			if (g_strv_length (pair) != 2)
+				{
+					g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+								 "Expected name=value, not \"%s\".", settings[i]);
+					ok = FALSE;
+				}
+			else if (g_str_has_prefix (pair[0], "context."))
+				{
+					ok = set_property_from_string (G_OBJECT (run->ctx), pair[0] + 8, pair[1], error);
+				}
+			else
+				{
+					ok = set_property_from_string (G_OBJECT (run->gtkm), pair[0], pair[1], error);
+				}
+			g_strfreev (pair);
+		}
+	g_strfreev (settings);
+
+	return ok;
+}
+
+static gdouble
+run_now (BenchRun *run)
+{
+	return (g_get_monotonic_time () - run->start) / 1000.0;
+}
+
+static void
+run_get_counts (BenchRun *run, BenchCounts *counts)
+{
+	GtkMapserverCacheStats stats;
+
+	mapserv_stub_get_counts (run->stub, &counts->requests, &counts->bytes);
+
+	/* an L1 miss goes on to L2, so L1 sees every lookup */
+	gtk_mapserver_context_get_cache_stats (run->ctx, &stats);
+	counts->lookups = stats.l1_hits + stats.l1_misses;
+	counts->hits = stats.l1_hits + stats.l2_hits;
+}
+
+static void
+run_wait (BenchRun *run, gint64 deadline, gboolean *until)
+{
+	while ((until == NULL || !*until) && g_get_monotonic_time () < deadline)
+		{
+			g_main_context_iteration (NULL, FALSE);
+			g_usleep (200);
+		}
+}
+
+static void
+on_run_rendered (GtkMapserver *gtkm, gpointer user_data)
+{
+	BenchRun *run = (BenchRun *)user_data;
+	BenchInteraction *interaction;
+
+	run->rendered = TRUE;
+
+	if (run->awaiting >= 0)
+		{
+			interaction = &g_array_index (run->interactions, BenchInteraction, run->awaiting);
+			interaction->time_to_visible = run_now (run) - interaction->end;
+			run->awaiting = -1;
+		}
+}
+
+static void
+run_close (BenchRun *run)
+{
+	BenchInteraction *interaction;
+	BenchCounts now;
+
+	if (run->interactions->len == 0)
+		{
+			return;
+		}
+
+	interaction = &g_array_index (run->interactions, BenchInteraction, run->interactions->len - 1);
+	run_get_counts (run, &now);
+	interaction->counts.requests = now.requests - interaction->at_start.requests;
+	interaction->counts.bytes = now.bytes - interaction->at_start.bytes;
+	interaction->counts.lookups = now.lookups - interaction->at_start.lookups;
+	interaction->counts.hits = now.hits - interaction->at_start.hits;
+}
+
+static void
+run_open (BenchRun *run, const gchar *type, gchar *detail)
+{
+	BenchInteraction interaction;
+
+	run_close (run);
+
+	memset (&interaction, 0, sizeof (BenchInteraction));
+	interaction.type = type;
+	interaction.detail = detail;
+	interaction.start = run_now (run);
+	interaction.time_to_visible = -1.0;
+	run_get_counts (run, &interaction.at_start);
+
+	g_array_append_val (run->interactions, interaction);
+}
+
+/* the last event of an interaction: from now on the map is awaited */
+static void
+run_end (BenchRun *run)
+{
+	BenchInteraction *interaction;
+
+	interaction = &g_array_index (run->interactions, BenchInteraction, run->interactions->len - 1);
+	interaction->end = run_now (run);
+	run->awaiting = run->interactions->len - 1;
+}
+
+static void
+inject (GtkWidget *gtkm, const BenchEvent *e)
+{
+	GdkEvent *event;
+	GdkWindow *window;
+	GdkWindow *canvas_window;
+	GdkDevice *pointer;
+
+	/* the canvas takes pointer events only on its own window, inside the
+	 * widget one */
+	window = gtk_widget_get_window (gtkm);
+	canvas_window = GOO_CANVAS (gtkm)->canvas_window;
+#if GTK_CHECK_VERSION(3, 20, 0)
+	pointer = gdk_seat_get_pointer (gdk_display_get_default_seat (gdk_window_get_display (window)));
+#else
+	pointer = gdk_device_manager_get_client_pointer (gdk_display_get_device_manager (gdk_window_get_display (window)));
+#endif
+
+	switch (e->type)
+		{
+			case BENCH_RESIZE:
+				gtk_widget_set_size_request (gtkm, e->width, e->height);
+				return;
+
+			case BENCH_KEY:
+				event = gdk_event_new (GDK_KEY_RELEASE);
+				event->key.window = g_object_ref (window);
+				event->key.send_event = TRUE;
+				event->key.time = GDK_CURRENT_TIME;
+				event->key.keyval = e->keyval;
+				event->key.state = e->state;
+				break;
+
+			case BENCH_PRESS:
+			case BENCH_RELEASE:
+				event = gdk_event_new (e->type == BENCH_PRESS ? GDK_BUTTON_PRESS : GDK_BUTTON_RELEASE);
+				event->button.window = g_object_ref (canvas_window);
+				event->button.send_event = TRUE;
+				event->button.time = GDK_CURRENT_TIME;
+				event->button.x = e->x;
+				event->button.y = e->y;
+				event->button.button = e->button;
+				event->button.state = e->type == BENCH_RELEASE && e->button == 1 ? GDK_BUTTON1_MASK : 0;
+				gdk_event_set_device (event, pointer);
+				break;
+
+			case BENCH_MOTION:
+				event = gdk_event_new (GDK_MOTION_NOTIFY);
+				event->motion.window = g_object_ref (canvas_window);
+				event->motion.send_event = TRUE;
+				event->motion.time = GDK_CURRENT_TIME;
+				event->motion.x = e->x;
+				event->motion.y = e->y;
+				event->motion.state = GDK_BUTTON1_MASK;
+				event->motion.is_hint = FALSE;
+				gdk_event_set_device (event, pointer);
+				break;
+
+			default:
+				return;
+		}
+
+	gtk_widget_event (gtkm, event);
+	gdk_event_free (event);
+}
+
+static void
+append_json_string (GString *out, const gchar *str)
+{
+	const gchar *p;
+
+	if (str == NULL)
+		{
+			g_string_append (out, "null");
+			return;
+		}
+
+	g_string_append_c (out, '"');
+	for (p = str; *p != '\0'; p++)
+		{
+			if (*p == '"' || *p == '\\')
+				{
+					g_string_append_printf (out, "\\%c", *p);
+				}
+			else if ((guchar)*p < 0x20)
+				{
+					g_string_append_printf (out, "\\u%04x", (guchar)*p);
+				}
+			else
+				{
+					g_string_append_c (out, *p);
+				}
+		}
+	g_string_append_c (out, '"');
+}
+
+static void
+append_json_double (GString *out, gdouble value)
+{
+	gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+	g_string_append (out, g_ascii_formatd (buffer, sizeof (buffer), "%.3f", value));
+}
+
+static void
+append_json_counts (GString *out, const BenchCounts *counts)
+{
+	g_string_append_printf (out, "\"requests\": %u, \"bytes\": %" G_GUINT64_FORMAT ", "
+							"\"cache_lookups\": %" G_GUINT64_FORMAT ", \"cache_hits\": %" G_GUINT64_FORMAT ", "
+							"\"cache_hit_ratio\": ",
+							counts->requests, counts->bytes, counts->lookups, counts->hits);
+	if (counts->lookups > 0)
+		{
+			append_json_double (out, (gdouble)counts->hits / counts->lookups);
+		}
+	else
+		{
+			g_string_append (out, "null");
+		}
+}
+
+static void
+append_json_run (GString *out, const gchar *config, BenchRun *run)
+{
+	BenchInteraction *interaction;
+	BenchCounts total;
+	gdouble ttv_sum;
+	gdouble ttv_max;
+	guint visible;
+	guint i;
+
+	memset (&total, 0, sizeof (BenchCounts));
+	ttv_sum = 0.0;
+	ttv_max = 0.0;
+	visible = 0;
+
+	g_string_append (out, "    {\n      \"config\": ");
+	append_json_string (out, config);
+	g_string_append (out, ",\n      \"interactions\": [");
+
+	for (i = 0; i < run->interactions->len; i++)
+		{
+			interaction = &g_array_index (run->interactions, BenchInteraction, i);
+
+			g_string_append_printf (out, "%s\n        { \"type\": \"%s\", \"detail\": ",
+									i > 0 ? "," : "", interaction->type);
+			append_json_string (out, interaction->detail);
+			g_string_append (out, ", \"start\": ");
+			append_json_double (out, interaction->start);
+			g_string_append (out, ", ");
+			append_json_counts (out, &interaction->counts);
+			g_string_append (out, ", \"time_to_visible\": ");
+
+			/* null: nothing to render, or overtaken by the next interaction */
+			if (interaction->time_to_visible >= 0.0)
+				{
+					append_json_double (out, interaction->time_to_visible);
+					ttv_sum += interaction->time_to_visible;
+					ttv_max = MAX (ttv_max, interaction->time_to_visible);
+					visible++;
+				}
+			else
+				{
+					g_string_append (out, "null");
+				}
+			g_string_append (out, " }");
+
+			total.requests += interaction->counts.requests;
+			total.bytes += interaction->counts.bytes;
+			total.lookups += interaction->counts.lookups;
+			total.hits += interaction->counts.hits;
+		}
+
+	g_string_append_printf (out, "\n      ],\n      \"total\": { \"interactions\": %u, \"rendered\": %u, ",
+							run->interactions->len, visible);
+	append_json_counts (out, &total);
+	g_string_append (out, ", \"time_to_visible_mean\": ");
+	if (visible > 0)
+		{
+			append_json_double (out, ttv_sum / visible);
+		}
+	else
+		{
+			g_string_append (out, "null");
+		}
+	g_string_append (out, ", \"time_to_visible_max\": ");
+	append_json_double (out, ttv_max);
+	g_string_append (out, " }\n    }");
+
+	g_printerr ("%-24s %4u interactions %6u requests %10" G_GUINT64_FORMAT " bytes %5.1f%% hits %8.1f ms mean to visible\n",
+				config[0] != '\0' ? config : "(defaults)",
+				run->interactions->len, total.requests, total.bytes,
+				total.lookups > 0 ? 100.0 * total.hits / total.lookups : 0.0,
+				visible > 0 ? ttv_sum / visible : 0.0);
+}
+
+/* a drag always exposes some of the map, which the stand-in must serve */
+static gboolean
+run_check (BenchRun *run, GError **error)
+{
+	BenchInteraction *interaction;
+	guint i;
+
+	for (i = 0; i < run->interactions->len; i++)
+		{
+			interaction = &g_array_index (run->interactions, BenchInteraction, i);
+			if (g_strcmp0 (interaction->type, "drag") == 0
+				&& interaction->counts.requests == 0)
+				{
+					g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+								 "Interaction %u, a drag of %s, made no request.",
+								 i + 1, interaction->detail != NULL ? interaction->detail : "0 0");
+					return FALSE;
+				}
+		}
+
+	return TRUE;
+}
+
+static gboolean
+replay (BenchTrace *trace, MapservStub *stub, const gchar *config, gdouble speed, gboolean check, GString *out, GError **error)
+{
+	gboolean ok;
+
+	GtkWidget *window;
+	BenchRun run;
+	BenchEvent *e;
+	gdouble press_x;
+	gdouble press_y;
+	guint i;
+
+	memset (&run, 0, sizeof (BenchRun));
+	run.stub = stub;
+	run.interactions = g_array_new (FALSE, FALSE, sizeof (BenchInteraction));
+	run.awaiting = -1;
+
+	/* a private context for every run, so each starts with a cold cache */
+	run.ctx = gtk_mapserver_context_new ();
+
+	window = gtk_offscreen_window_new ();
+	run.gtkm = gtk_mapserver_new ();
+	gtk_container_add (GTK_CONTAINER (window), run.gtkm);
+	g_object_set (G_OBJECT (run.gtkm),
+				  "context", run.ctx,
+				  NULL);
+	if (!apply_config (&run, config, error))
+		{
+			gtk_widget_destroy (window);
+			g_object_unref (run.ctx);
+			g_array_free (run.interactions, TRUE);
+			return FALSE;
+		}
+	g_signal_connect (run.gtkm, "rendered", G_CALLBACK (on_run_rendered), &run);
+
+	gtk_widget_set_size_request (run.gtkm, trace->width, trace->height);
+	gtk_widget_show_all (window);
+
+	gtk_mapserver_set_home (GTK_MAPSERVER (run.gtkm), mapserv_stub_get_url (stub), &trace->home);
+	run_wait (&run, g_get_monotonic_time () + TIMEOUT * G_USEC_PER_SEC, &run.rendered);
+	if (!run.rendered)
+		{
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "The map was never rendered.");
+			gtk_widget_destroy (window);
+			g_object_unref (run.ctx);
+			g_array_free (run.interactions, TRUE);
+			return FALSE;
+		}
+
+	press_x = 0.0;
+	press_y = 0.0;
+	run.start = g_get_monotonic_time ();
+	for (i = 0; i < trace->events->len; i++)
+		{
+			e = &g_array_index (trace->events, BenchEvent, i);
+
+			run_wait (&run, run.start + (gint64)(e->time * 1000.0 / speed), NULL);
+
+			switch (e->type)
+				{
+					case BENCH_KEY:
+						run_open (&run, "key", gtk_accelerator_name (e->keyval, e->state));
+						run_end (&run);
+						break;
+
+					case BENCH_RESIZE:
+						run_open (&run, "resize", g_strdup_printf ("%dx%d", e->width, e->height));
+						run_end (&run);
+						break;
+
+					case BENCH_PRESS:
+						run_open (&run, e->button == 1 ? "drag" : "button", NULL);
+						press_x = e->x;
+						press_y = e->y;
+						break;
+
+					case BENCH_RELEASE:
+						if (run.interactions->len > 0)
+							{
+								BenchInteraction *interaction;
+
+								interaction = &g_array_index (run.interactions, BenchInteraction, run.interactions->len - 1);
+								if (interaction->detail == NULL)
+									{
+										interaction->detail = g_strdup_printf ("%+.0f %+.0f", e->x - press_x, e->y - press_y);
+									}
+								run_end (&run);
+							}
+						break;
+
+					case BENCH_MOTION:
+						break;
+				}
+
+			inject (run.gtkm, e);
+		}
+
+	/* the last image is awaited too */
+	run.rendered = run.awaiting < 0;
+	run_wait (&run, g_get_monotonic_time () + TIMEOUT * G_USEC_PER_SEC, &run.rendered);
+	run_close (&run);
+
+	append_json_run (out, config, &run);
+	ok = !check || run_check (&run, error);
+
+	gtk_widget_destroy (window);
+	g_object_unref (run.ctx);
+
+	for (i = 0; i < run.interactions->len; i++)
+		{
+			g_free (g_array_index (run.interactions, BenchInteraction, i).detail);
+		}
+	g_array_free (run.interactions, TRUE);
+
+	return ok;
+}
+
+int
+main (int argc, char **argv)
+{
+	gchar *record_to = NULL;
+	gchar *replay_from = NULL;
+	gchar **configs = NULL;
+	gchar *output = NULL;
+	gchar *url = NULL;
+	gchar *home_str = NULL;
+	gint latency = 0;
+	gdouble speed = 1.0;
+	gboolean check = FALSE;
+
+	GOptionEntry entries[] =
+		{
+			{ "record", 'r', 0, G_OPTION_ARG_FILENAME, &record_to, "Record the interactions with a map window into FILE", "FILE" },
+			{ "replay", 'p', 0, G_OPTION_ARG_FILENAME, &replay_from, "Replay the trace in FILE", "FILE" },
+			{ "config", 'c', 0, G_OPTION_ARG_STRING_ARRAY, &configs, "Replay with these properties, \"name=value,context.name=value\"; repeatable", "PROPERTIES" },
+			{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write the JSON report to FILE instead of stdout", "FILE" },
+			{ "latency", 'l', 0, G_OPTION_ARG_INT, &latency, "Milliseconds the stand-in server holds each response (default 0)", "MS" },
+			{ "speed", 's', 0, G_OPTION_ARG_DOUBLE, &speed, "Replay speed factor (default 1)", "FACTOR" },
+			{ "url", 'u', 0, G_OPTION_ARG_STRING, &url, "Record against this map url instead of the stand-in server", "URL" },
+			{ "home", 0, 0, G_OPTION_ARG_STRING, &home_str, "Home extent of the recording (default \"0 0 1000 1000\")", "EXTENT" },
+			{ "check", 0, 0, G_OPTION_ARG_NONE, &check, "Fail if a replayed drag made no request", NULL },
+			{ NULL }
+		};
+
+	GOptionContext *context;
+	GError *error;
+
+	GtkMapserverExtent home;
+	BenchTrace *trace;
+	MapservStub *stub;
+	GString *out;
+	gboolean ok;
+	guint n_configs;
+	guint i;
+
+	context = g_option_context_new (NULL);
+	g_option_context_set_summary (context, "Records map interactions, or replays them and reports what each one cost.");
+	g_option_context_add_main_entries (context, entries, NULL);
+
+	error = NULL;
+	if (!g_option_context_parse (context, &argc, &argv, &error))
+		{
+			g_printerr ("%s\n", error->message);
+			return 1;
+		}
+	if ((record_to == NULL) == (replay_from == NULL) || latency < 0 || speed <= 0.0)
+		{
+			g_printerr ("%s", g_option_context_get_help (context, TRUE, NULL));
+			return 1;
+		}
+	g_option_context_free (context);
+
+	if (!gtk_init_check (&argc, &argv))
+		{
+			g_printerr ("No display, skipped.\n");
+			return 77;
+		}
+
+	if (record_to != NULL)
+		{
+			home.minx = 0.0;
+			home.miny = 0.0;
+			home.maxx = 1000.0;
+			home.maxy = 1000.0;
+			if (home_str != NULL)
+				{
+					gchar **coords;
+
+					coords = g_strsplit_set (home_str, " ,", -1);
+					if (g_strv_length (coords) != 4)
+						{
+							g_printerr ("The home extent is \"minx miny maxx maxy\".\n");
+							return 1;
+						}
+					home.minx = g_ascii_strtod (coords[0], NULL);
+					home.miny = g_ascii_strtod (coords[1], NULL);
+					home.maxx = g_ascii_strtod (coords[2], NULL);
+					home.maxy = g_ascii_strtod (coords[3], NULL);
+					g_strfreev (coords);
+				}
+
+			return record (record_to, url, &home, latency);
+		}
+
+	trace = trace_load (replay_from, &error);
+	if (trace == NULL)
+		{
+			g_printerr ("%s\n", error->message);
+			return 1;
+		}
+	if (trace->events->len == 0)
+		{
+			g_printerr ("%s has no events.\n", replay_from);
+			return 1;
+		}
+
+	stub = mapserv_stub_new (latency, &error);
+	if (stub == NULL)
+		{
+			g_printerr ("%s\n", error->message);
+			return 1;
+		}
+
+	out = g_string_new ("{\n  \"trace\": ");
+	append_json_string (out, replay_from);
+	g_string_append_printf (out, ",\n  \"events\": %u,\n  \"latency\": %d,\n  \"speed\": ", trace->events->len, latency);
+	append_json_double (out, speed);
+	g_string_append (out, ",\n  \"runs\": [\n");
+
+	ok = TRUE;
+	n_configs = configs != NULL ? g_strv_length (configs) : 0;
+	for (i = 0; i < MAX (1, n_configs) && ok; i++)
+		{
+			if (i > 0)
+				{
+					g_string_append (out, ",\n");
+				}
+			ok = replay (trace, stub, n_configs > 0 ? configs[i] : "", speed, check, out, &error);
+		}
+	g_string_append (out, "\n  ]\n}\n");
+
+	if (!ok)
+		{
+			g_printerr ("%s\n", error->message);
+		}
+	else if (output != NULL)
+		{
+			if (!g_file_set_contents (output, out->str, out->len, &error))
+				{
+					g_printerr ("%s\n", error->message);
+					ok = FALSE;
+				}
+		}
+	else
+		{
+			g_print ("%s", out->str);
+		}
+
+	g_string_free (out, TRUE);
+	mapserv_stub_free (stub);
+	trace_free (trace);
+	g_strfreev (configs);
+
+	return ok ? 0 : 1;
+}
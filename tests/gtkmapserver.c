@@ -19,6 +19,7 @@
 #include <stdlib.h>
 
 #include "gtkmapserver.h"
+#include "gtkmapserveroverview.h"
 
 /* This is our handler for the "delete-event" signal of the window, which
  is emitted when the 'x' close button is clicked. We just exit here. */
@@ -34,8 +35,11 @@ int
 main (int argc, char **argv)
 {
 	GtkWidget *window;
+	GtkWidget *box;
 	GtkWidget *gtkmap;
+	GtkWidget *overview;
 	GtkMapserverExtent *ext;
+	gchar *url;
 
 	/* Initialize GTK+. */
 	gtk_init (&argc, &argv);
@@ -47,21 +51,50 @@ main (int argc, char **argv)
 					  "delete_event", G_CALLBACK (on_delete_event),
 		              NULL);
 
+	box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+	gtk_container_add (GTK_CONTAINER (window), box);
+
 	gtkmap = gtk_mapserver_new ();
-	gtk_container_add (GTK_CONTAINER (window), gtkmap);
+	gtk_box_pack_start (GTK_BOX (box), gtkmap, TRUE, TRUE, 0);
+
+	overview = gtk_mapserver_overview_new (GTK_MAPSERVER (gtkmap));
+	gtk_widget_set_size_request (overview, 160, 150);
+	gtk_widget_set_valign (overview, GTK_ALIGN_START);
+	gtk_box_pack_start (GTK_BOX (box), overview, FALSE, FALSE, 0);
 
 	gtk_widget_show_all (window);
 
+	if (argc > 1)
+		{
+			/* offline: a pack created by the seed tool */
+			GError *error = NULL;
+
+			if (!gtk_mapserver_mount_pack (GTK_MAPSERVER (gtkmap), argv[1], &error))
+				{
+					g_warning ("Unable to mount pack: %s.", error->message);
+					return 1;
+				}
+
+			gtk_main ();
+
+			return 0;
+		}
+
 	ext = gtk_mapserver_get_extent (GTK_MAPSERVER (gtkmap), "http://atlante/cgi-bin/mapserv?map=/var/www_mapper/www_pm4/config/cdu/RU_cdu.map&mode=itemquery&qlayer=catasto&qstring=\"foglio\"='2' and \"part\"='22'&map.layer[catasto]=TEMPLATE \"shpext.html\"");
 	if (ext != NULL)
 		{
 			g_message ("Extent: %f %f %f %f", ext->minx, ext->miny, ext->maxx, ext->maxy);
+			g_free (ext);
 		}
 
 	ext = gtk_mapserver_get_extent (GTK_MAPSERVER (gtkmap), "http://atlante/cgi-bin/mapserv?map=/var/www_mapper/www_pm4/config/cdu/RU_cdu.map&mode=itemquery&qlayer=catasto&qstring=TRUE&map.layer[catasto]=TEMPLATE \"mapext.html\"");
-	gtk_mapserver_set_home (GTK_MAPSERVER (gtkmap),
-							g_strdup_printf ("http://atlante/cgi-bin/mapserv?map=/var/www_mapper/www_pm4/config/cdu/RU_cdu.map&mode=map&mapext %f %f %f %f&layers=catasto", ext->minx, ext->miny, ext->maxx, ext->maxy),
-							NULL);
+	if (ext != NULL)
+		{
+			url = g_strdup_printf ("http://atlante/cgi-bin/mapserv?map=/var/www_mapper/www_pm4/config/cdu/RU_cdu.map&mode=map&mapext %f %f %f %f&layers=catasto", ext->minx, ext->miny, ext->maxx, ext->maxy);
+			gtk_mapserver_set_home (GTK_MAPSERVER (gtkmap), url, NULL);
+			g_free (url);
+			g_free (ext);
+		}
 
 	/* Pass control to the GTK+ main event loop. */
 	gtk_main ();
@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <libsoup/soup.h>
+
+#include "mapservstub.h"
+
+/* mapserv refuses larger images by default */
+#define MAXSIZE 4096
+
+struct _MapservStub
+	{
+		GThread *thread;
+		GMainContext *context;
+		GMainLoop *loop;
+		SoupServer *server;
+
+		guint latency;
+		gchar *url;
+		GError *error;
+
+		GMutex lock;
+		GCond started;
+		gboolean ready;
+
+		guint requests;
+		guint64 bytes;
+		guint64 pixels;
+		guint fail;
+	};
+
+typedef struct
+	{
+		SoupServer *server;
+		SoupMessage *msg;
+	} MapservStubDelayed;
+
+static gboolean
+mapserv_stub_on_delay (gpointer user_data)
+{
+	MapservStubDelayed *delayed = (MapservStubDelayed *)user_data;
+
+	soup_server_unpause_message (delayed->server, delayed->msg);
+	g_object_unref (delayed->msg);
+	g_free (delayed);
+
+	return FALSE;
+}
+
+static void
+mapserv_stub_handler (SoupServer *server,
+					  SoupMessage *msg,
+					  const char *path,
+					  GHashTable *query,
+					  SoupClientContext *client,
+					  gpointer user_data)
+{
+	MapservStub *stub = (MapservStub *)user_data;
+
+	const gchar *mapsize;
+	const gchar *uri_query;
+	gchar **size;
+	gint width;
+	gint height;
+	GdkPixbuf *pixbuf;
+	gchar *buffer;
+	gsize length;
+	GError *error;
+
+	mapsize = query != NULL ? g_hash_table_lookup (query, "mapsize") : NULL;
+	if (mapsize == NULL)
+		{
+			soup_message_set_status (msg, SOUP_STATUS_BAD_REQUEST);
+			return;
+		}
+
+	size = g_strsplit (mapsize, " ", -1);
+	width = g_strv_length (size) == 2 ? atoi (size[0]) : 0;
+	height = g_strv_length (size) == 2 ? atoi (size[1]) : 0;
+	g_strfreev (size);
+	if (width <= 0 || height <= 0 || width > MAXSIZE || height > MAXSIZE)
+		{
+			soup_message_set_status (msg, SOUP_STATUS_BAD_REQUEST);
+			return;
+		}
+
+	g_mutex_lock (&stub->lock);
+	if (stub->fail > 0)
+		{
+			stub->fail--;
+			stub->requests++;
+			g_mutex_unlock (&stub->lock);
+			soup_message_set_status (msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+			return;
+		}
+	g_mutex_unlock (&stub->lock);
+
+	uri_query = soup_message_get_uri (msg)->query;
+
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+	gdk_pixbuf_fill (pixbuf, (g_str_hash (uri_query) << 8) | 0xff);
+
+	error = NULL;
+	if (!gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &length, "png", &error, NULL))
+		{
+			g_warning ("Unable to encode image: %s.", error->message);
+			g_error_free (error);
+			g_object_unref (pixbuf);
+			soup_message_set_status (msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+			return;
+		}
+	g_object_unref (pixbuf);
+
+	soup_message_set_status (msg, SOUP_STATUS_OK);
+	soup_message_set_response (msg, "image/png", SOUP_MEMORY_TAKE, buffer, length);
+
+	g_mutex_lock (&stub->lock);
+	stub->requests++;
+	stub->bytes += length;
+	stub->pixels += (guint64)width * height;
+	g_mutex_unlock (&stub->lock);
+
+	if (stub->latency > 0)
+		{
+			MapservStubDelayed *delayed;
+			GSource *source;
+
+			delayed = g_new0 (MapservStubDelayed, 1);
+			delayed->server = server;
+			delayed->msg = g_object_ref (msg);
+
+			soup_server_pause_message (server, msg);
+
+			source = g_timeout_source_new (stub->latency);
+			g_source_set_callback (source, mapserv_stub_on_delay, delayed, NULL);
+			g_source_attach (source, stub->context);
+			g_source_unref (source);
+		}
+}
+
+static gboolean
+mapserv_stub_on_started (gpointer user_data)
+{
+	MapservStub *stub = (MapservStub *)user_data;
+
+	g_mutex_lock (&stub->lock);
+	stub->ready = TRUE;
+	g_cond_signal (&stub->started);
+	g_mutex_unlock (&stub->lock);
+
+	return FALSE;
+}
+
+static gpointer
+mapserv_stub_thread (gpointer data)
+{
+	MapservStub *stub = (MapservStub *)data;
+
+	GSList *uris;
+	gchar *base;
+	gboolean listening;
+
+	g_main_context_push_thread_default (stub->context);
+
+	stub->server = soup_server_new (SOUP_SERVER_SERVER_HEADER, "mapserv-stub ", NULL);
+	soup_server_add_handler (stub->server, NULL, mapserv_stub_handler, stub, NULL);
+
+	listening = soup_server_listen_local (stub->server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &stub->error);
+	if (listening)
+		{
+			uris = soup_server_get_uris (stub->server);
+			base = soup_uri_to_string ((SoupURI *)uris->data, FALSE);
+			stub->url = g_strdup_printf ("%scgi-bin/mapserv?map=stub.map&mode=map&layers=all", base);
+			g_free (base);
+			g_slist_free_full (uris, (GDestroyNotify)soup_uri_free);
+		}
+
+	if (listening)
+		{
+			GSource *source;
+
+			/* ready only once the loop runs, so a quit from
+			 * mapserv_stub_free() always stops it */
+			source = g_idle_source_new ();
+			g_source_set_callback (source, mapserv_stub_on_started, stub, NULL);
+			g_source_attach (source, stub->context);
+			g_source_unref (source);
+
+			g_main_loop_run (stub->loop);
+			soup_server_disconnect (stub->server);
+		}
+	else
+		{
+			mapserv_stub_on_started (stub);
+		}
+	g_object_unref (stub->server);
+
+	g_main_context_pop_thread_default (stub->context);
+
+	return NULL;
+}
+
+/**
+ * mapserv_stub_new:
+ * @latency: milliseconds each response is held back.
+ * @error:
+ *
+ * Returns: a running server on a free port of the loopback interface.
+ */
+MapservStub
+*mapserv_stub_new (guint latency, GError **error)
+{
+	MapservStub *stub;
+
+	stub = g_new0 (MapservStub, 1);
+	stub->latency = latency;
+	stub->context = g_main_context_new ();
+	stub->loop = g_main_loop_new (stub->context, FALSE);
+	g_mutex_init (&stub->lock);
+	g_cond_init (&stub->started);
+
+	stub->thread = g_thread_new ("mapserv-stub", mapserv_stub_thread, stub);
+
+	g_mutex_lock (&stub->lock);
+	while (!stub->ready)
+		{
+			g_cond_wait (&stub->started, &stub->lock);
+		}
+	g_mutex_unlock (&stub->lock);
+
+	if (stub->error != NULL)
+		{
+			g_propagate_error (error, stub->error);
+			stub->error = NULL;
+			mapserv_stub_free (stub);
+			return NULL;
+		}
+
+	return stub;
+}
+
+void
+mapserv_stub_free (MapservStub *stub)
+{
+	g_main_loop_quit (stub->loop);
+	g_thread_join (stub->thread);
+
+	g_main_loop_unref (stub->loop);
+	g_main_context_unref (stub->context);
+	g_mutex_clear (&stub->lock);
+	g_cond_clear (&stub->started);
+	g_free (stub->url);
+	g_free (stub);
+}
+
+/**
+ * mapserv_stub_get_url:
+ * @stub:
+ *
+ * Returns: a map url without mapext and mapsize, as gtk_mapserver_set_home()
+ * wants it.
+ */
+const gchar
+*mapserv_stub_get_url (MapservStub *stub)
+{
+	return stub->url;
+}
+
+/**
+ * mapserv_stub_get_counts:
+ * @stub:
+ * @requests: (out) (allow-none): images served so far.
+ * @bytes: (out) (allow-none): response bytes served so far.
+ */
+void
+mapserv_stub_get_counts (MapservStub *stub, guint *requests, guint64 *bytes)
+{
+	g_mutex_lock (&stub->lock);
+	if (requests != NULL)
+		{
+			*requests = stub->requests;
+		}
+	if (bytes != NULL)
+		{
+			*bytes = stub->bytes;
+		}
+	g_mutex_unlock (&stub->lock);
+}
+
+/**
+ * mapserv_stub_get_pixels:
+ * @stub:
+ *
+ * Returns: the image area served so far, in pixels.
+ */
+guint64
+mapserv_stub_get_pixels (MapservStub *stub)
+{
+	guint64 pixels;
+
+	g_mutex_lock (&stub->lock);
+	pixels = stub->pixels;
+	g_mutex_unlock (&stub->lock);
+
+	return pixels;
+}
+
+/**
+ * mapserv_stub_fail_next:
+ * @stub:
+ * @requests: how many of the next image requests get a 500.
+ */
+void
+mapserv_stub_fail_next (MapservStub *stub, guint requests)
+{
+	g_mutex_lock (&stub->lock);
+	stub->fail = requests;
+	g_mutex_unlock (&stub->lock);
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __MAPSERV_STUB_H__
+#define __MAPSERV_STUB_H__
+
+#include <glib.h>
+
+
+G_BEGIN_DECLS
+
+
+/* A local stand-in for mapserv: answers every request with a png of the
+ * requested mapsize, whose colour depends only on the query. It runs in its
+ * own thread and main context, so it keeps serving while the caller
+ * iterates or blocks its own main loop. */
+typedef struct _MapservStub MapservStub;
+
+MapservStub *mapserv_stub_new (guint latency, GError **error);
+void mapserv_stub_free (MapservStub *stub);
+
+const gchar *mapserv_stub_get_url (MapservStub *stub);
+
+void mapserv_stub_get_counts (MapservStub *stub, guint *requests, guint64 *bytes);
+guint64 mapserv_stub_get_pixels (MapservStub *stub);
+
+void mapserv_stub_fail_next (MapservStub *stub, guint requests);
+
+
+G_END_DECLS
+
+#endif /* __MAPSERV_STUB_H__ */
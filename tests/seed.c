@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Renders every tile of a region into a single pack file that GtkMapserver
+ * can mount with gtk_mapserver_mount_pack() to work offline.
+ *
+ *   seed -o region.pack -j 8 "http://host/cgi-bin/mapserv?map=...&mode=map&layers=..." \
+ *        "minx miny maxx maxy" 10 2.5 0.5
+ *
+ * Scales are in map units per pixel; the url must not contain mapext or mapsize.
+ */
+
+#include <stdlib.h>
+
+#include "gtkmapserver.h"
+#include "gtkmapserverpack.h"
+
+typedef struct
+	{
+		GtkMapserverPackWriter *writer;
+		SoupSession *session;
+		const gchar *url;
+		guint tile_size;
+
+		gint done;
+		gint failed;
+		guint total;
+	} SeedData;
+
+typedef struct
+	{
+		guint level;
+		guint col;
+		guint row;
+	} SeedTile;
+
+static void
+seed_tile (gpointer data, gpointer user_data)
+{
+	SeedTile *tile = (SeedTile *)data;
+	SeedData *seed = (SeedData *)user_data;
+
+	GtkMapserverExtent ext;
+	SoupMessage *msg;
+	const gchar *content_type;
+	GError *error;
+	gchar *_url;
+	gchar minx[G_ASCII_DTOSTR_BUF_SIZE];
+	gchar miny[G_ASCII_DTOSTR_BUF_SIZE];
+	gchar maxx[G_ASCII_DTOSTR_BUF_SIZE];
+	gchar maxy[G_ASCII_DTOSTR_BUF_SIZE];
+
+	gtk_mapserver_pack_writer_get_tile_extent (seed->writer, tile->level, tile->col, tile->row, &ext);
+
+	_url = g_strdup_printf ("%s&mapsize=%u %u&mapext=%s %s %s %s",
+							seed->url,
+							seed->tile_size,
+							seed->tile_size,
+							g_ascii_formatd (minx, sizeof (minx), "%f", ext.minx),
+							g_ascii_formatd (miny, sizeof (miny), "%f", ext.miny),
+							g_ascii_formatd (maxx, sizeof (maxx), "%f", ext.maxx),
+							g_ascii_formatd (maxy, sizeof (maxy), "%f", ext.maxy));
+
+	msg = soup_message_new (SOUP_METHOD_GET, _url);
+	if (SOUP_IS_MESSAGE (msg))
+		{
+			soup_message_set_flags (msg, SOUP_MESSAGE_NO_REDIRECT);
+			soup_session_send_message (seed->session, msg);
+		}
+
+	content_type = SOUP_IS_MESSAGE (msg)
+				   ? soup_message_headers_get_content_type (msg->response_headers, NULL)
+				   : NULL;
+
+	if (!SOUP_IS_MESSAGE (msg) || !SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+		{
+			g_warning ("Error on retrieving url: %s.", _url);
+			g_atomic_int_inc (&seed->failed);
+		}
+	else if (!g_str_has_prefix (content_type != NULL ? content_type : "", "image/"))
+		{
+			/* mapserv reports errors with a 200 and an html or xml page */
+			g_warning ("No image from url: %s (%s).", _url,
+					   content_type != NULL ? content_type : "no content type");
+			g_atomic_int_inc (&seed->failed);
+		}
+	else
+		{
+			error = NULL;
+			if (!gtk_mapserver_pack_writer_add_tile (seed->writer,
+													 tile->level, tile->col, tile->row,
+													 (const guchar *)msg->response_body->data,
+													 msg->response_body->length,
+													 &error))
+				{
+					g_warning ("Error on writing tile: %s.",
+							   error != NULL && error->message != NULL ? error->message : "no details");
+					g_clear_error (&error);
+					g_atomic_int_inc (&seed->failed);
+				}
+		}
+
+	if (msg != NULL)
+		{
+			g_object_unref (msg);
+		}
+	g_free (_url);
+	g_free (tile);
+
+	g_print ("\r%d/%u", g_atomic_int_add (&seed->done, 1) + 1, seed->total);
+}
+
+int
+main (int argc, char **argv)
+{
+	gchar *output = NULL;
+	gint tile_size = 256;
+	gint jobs = 4;
+
+	GOptionEntry entries[] =
+		{
+			{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Pack file to write", "FILE" },
+			{ "tile-size", 't', 0, G_OPTION_ARG_INT, &tile_size, "Tile side in pixels (default 256)", "N" },
+			{ "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Concurrent renders (default 4)", "N" },
+			{ NULL }
+		};
+
+	GOptionContext *context;
+	GError *error;
+
+	GtkMapserverExtent ext;
+	gchar **coords;
+	gdouble *scales;
+	guint n_scales;
+	guint level;
+	guint col;
+	guint row;
+	guint cols;
+	guint rows;
+
+	SeedData seed;
+	GThreadPool *pool;
+
+	context = g_option_context_new ("URL \"MINX MINY MAXX MAXY\" SCALE [SCALE...]");
+	g_option_context_set_summary (context, "Renders a region into an offline map pack.");
+	g_option_context_add_main_entries (context, entries, NULL);
+
+	error = NULL;
+	if (!g_option_context_parse (context, &argc, &argv, &error))
+		{
+			g_printerr ("%s\n", error->message);
+			return 1;
+		}
+	if (argc < 4 || output == NULL || tile_size <= 0 || jobs <= 0)
+		{
+			g_printerr ("%s", g_option_context_get_help (context, TRUE, NULL));
+			return 1;
+		}
+	g_option_context_free (context);
+
+	coords = g_strsplit (argv[2], " ", -1);
+	if (g_strv_length (coords) != 4)
+		{
+			g_printerr ("Extent must be \"minx miny maxx maxy\".\n");
+			return 1;
+		}
+	ext.minx = g_ascii_strtod (coords[0], NULL);
+	ext.miny = g_ascii_strtod (coords[1], NULL);
+	ext.maxx = g_ascii_strtod (coords[2], NULL);
+	ext.maxy = g_ascii_strtod (coords[3], NULL);
+	g_strfreev (coords);
+
+	if (ext.maxx <= ext.minx || ext.maxy <= ext.miny)
+		{
+			g_printerr ("Extent is empty.\n");
+			return 1;
+		}
+
+	n_scales = argc - 3;
+	scales = g_new0 (gdouble, n_scales);
+	for (level = 0; level < n_scales; level++)
+		{
+			scales[level] = g_ascii_strtod (argv[level + 3], NULL);
+		}
+
+	seed.writer = gtk_mapserver_pack_writer_new (output, &ext, tile_size, scales, n_scales, &error);
+	if (seed.writer == NULL)
+		{
+			g_printerr ("%s\n", error->message);
+			return 1;
+		}
+
+	seed.session = soup_session_sync_new_with_options (SOUP_SESSION_ADD_FEATURE_BY_TYPE, SOUP_TYPE_CONTENT_DECODER,
+													   SOUP_SESSION_USER_AGENT, "get ",
+													   SOUP_SESSION_MAX_CONNS, jobs,
+													   SOUP_SESSION_MAX_CONNS_PER_HOST, jobs,
+													   NULL);
+	seed.url = argv[1];
+	seed.tile_size = tile_size;
+	seed.done = 0;
+	seed.failed = 0;
+	seed.total = 0;
+
+	for (level = 0; level < n_scales; level++)
+		{
+			gtk_mapserver_pack_writer_get_grid (seed.writer, level, &cols, &rows);
+			seed.total += cols * rows;
+		}
+
+	pool = g_thread_pool_new (seed_tile, &seed, jobs, TRUE, NULL);
+	for (level = 0; level < n_scales; level++)
+		{
+			gtk_mapserver_pack_writer_get_grid (seed.writer, level, &cols, &rows);
+			for (row = 0; row < rows; row++)
+				{
+					for (col = 0; col < cols; col++)
+						{
+							SeedTile *tile = g_new0 (SeedTile, 1);
+
+							tile->level = level;
+							tile->col = col;
+							tile->row = row;
+							g_thread_pool_push (pool, tile, NULL);
+						}
+				}
+		}
+
+	/* waits for every tile */
+	g_thread_pool_free (pool, FALSE, TRUE);
+	g_print ("\n");
+
+	if (!gtk_mapserver_pack_writer_close (seed.writer, &error))
+		{
+			g_printerr ("%s\n", error->message);
+			return 1;
+		}
+
+	g_object_unref (seed.session);
+	g_free (scales);
+	g_free (output);
+
+	if (seed.failed > 0)
+		{
+			g_printerr ("%d of %u tiles failed.\n", seed.failed, seed.total);
+			return 2;
+		}
+
+	return 0;
+}
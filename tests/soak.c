@@ -0,0 +1,517 @@
+/*
+ * Copyright (C) 2015 Andrea Zagli <azagli@libero.it>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Drives a GtkMapserver through thousands of scripted pan, zoom, home and
+ * resize cycles against the local stand-in server, sampling the resident
+ * set size and the live objects of the types a map session creates.
+ * After the warm-up the cache is full and every sample must stay within
+ * the tolerance of the ones before: it fails if memory keeps growing.
+ * Before that it checks that a resize fetches only the exposed strip,
+ * that a pan after a failed strip renders the whole map again, and that the history walks back from pinned images with no request.
+ *
+ *   soak -n 5000 -s 100 -t 10
+ *
+ * Exits with 77, the automake code for a skipped test, without a display.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtkmapserver.h"
+#include "mapservstub.h"
+
+#ifdef G_OS_UNIX
+	#include <unistd.h>
+#endif
+
+/* zoom levels around home and grid positions per home width */
+#define LEVELS 5
+#define STEPS 8
+#define TIMEOUT 10
+
+typedef struct
+	{
+		guint cycle;
+		guint64 rss;
+		guint pixbufs;
+		guint messages;
+		guint loaders;
+		guint64 l1_used;
+		guint64 l2_used;
+	} SoakSample;
+
+static gboolean rendered;
+
+static void
+on_rendered (GtkMapserver *gtkm, gpointer user_data)
+{
+	rendered = TRUE;
+}
+
+static gboolean
+wait_rendered (void)
+{
+	gint64 deadline;
+
+	deadline = g_get_monotonic_time () + TIMEOUT * G_USEC_PER_SEC;
+	while (!rendered && g_get_monotonic_time () < deadline)
+		{
+			g_main_context_iteration (NULL, FALSE);
+			g_usleep (200);
+		}
+
+	return rendered;
+}
+
+/* kB, 0 where /proc is not available */
+static guint64
+get_rss (void)
+{
+	gchar *statm;
+	guint64 size;
+	guint64 resident;
+	guint64 rss;
+
+	rss = 0;
+	if (g_file_get_contents ("/proc/self/statm", &statm, NULL, NULL))
+		{
+			if (sscanf (statm, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT, &size, &resident) == 2)
+				{
+#ifdef G_OS_UNIX
+					rss = resident * sysconf (_SC_PAGESIZE) / 1024;
+#endif
+				}
+			g_free (statm);
+		}
+
+	return rss;
+}
+
+static guint
+get_instances (GType type)
+{
+#if GLIB_CHECK_VERSION(2, 44, 0)
+	return g_type_get_instance_count (type);
+#else
+	return 0;
+#endif
+}
+
+static void
+sample (GtkMapserverContext *ctx, guint cycle, SoakSample *s)
+{
+	GtkMapserverCacheStats stats;
+
+	gtk_mapserver_context_get_cache_stats (ctx, &stats);
+
+	s->cycle = cycle;
+	s->rss = get_rss ();
+	s->pixbufs = get_instances (GDK_TYPE_PIXBUF);
+	s->messages = get_instances (SOUP_TYPE_MESSAGE);
+	s->loaders = get_instances (GDK_TYPE_PIXBUF_LOADER);
+	s->l1_used = stats.l1_used;
+	s->l2_used = stats.l2_used;
+
+	g_print ("%8u %10" G_GUINT64_FORMAT " %8u %8u %8u %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT "\n",
+			 s->cycle, s->rss, s->pixbufs, s->messages, s->loaders,
+			 s->l1_used / 1024, s->l2_used / 1024);
+}
+
+static gboolean
+grows (const gchar *what, guint64 baseline, guint64 last, gdouble tolerance, guint64 slack)
+{
+	if (last > baseline * (1.0 + tolerance / 100.0) + slack)
+		{
+			g_printerr ("%s keeps growing: %" G_GUINT64_FORMAT " after warm-up, %" G_GUINT64_FORMAT " at the end.\n",
+						what, baseline, last);
+			return TRUE;
+		}
+
+	return FALSE;
+}
+
+int
+main (int argc, char **argv)
+{
+	gint cycles = 4000;
+	gint every = 100;
+	gint warmup = 25;
+	gdouble tolerance = 10.0;
+	gint seed = 1;
+
+	GOptionEntry entries[] =
+		{
+			{ "cycles", 'n', 0, G_OPTION_ARG_INT, &cycles, "Interactions to run (default 4000)", "N" },
+			{ "sample", 's', 0, G_OPTION_ARG_INT, &every, "Interactions between samples (default 100)", "N" },
+			{ "warmup", 'w', 0, G_OPTION_ARG_INT, &warmup, "Percent of cycles not checked (default 25)", "PERCENT" },
+			{ "tolerance", 't', 0, G_OPTION_ARG_DOUBLE, &tolerance, "Allowed growth in percent (default 10)", "PERCENT" },
+			{ "seed", 0, 0, G_OPTION_ARG_INT, &seed, "Random seed of the script (default 1)", "N" },
+			{ NULL }
+		};
+
+	GOptionContext *context;
+	GError *error;
+
+	MapservStub *stub;
+	GtkMapserverContext *ctx;
+	GtkWidget *window;
+	GtkWidget *gtkm;
+	GRand *rand;
+
+	GtkMapserverExtent home;
+	GtkMapserverExtent ext;
+	gdouble cx;
+	gdouble cy;
+	gdouble half;
+	gint level;
+	gint col;
+	gint row;
+	gint width;
+	gint height;
+
+	GArray *samples;
+	SoakSample s;
+	SoakSample baseline;
+	SoakSample last;
+	guint cycle;
+	guint i;
+	gboolean failed;
+	guint requests;
+	guint requests_after;
+	guint64 pixels;
+	guint64 l1_size;
+	guint64 l2_size;
+	gint views;
+	gdouble step;
+
+#ifdef G_OS_UNIX
+	/* instance counts must be enabled before the type system starts */
+	if (g_strrstr (g_getenv ("GOBJECT_DEBUG") != NULL ? g_getenv ("GOBJECT_DEBUG") : "", "instance-count") == NULL)
+		{
+			g_setenv ("GOBJECT_DEBUG", "instance-count", TRUE);
+			execv ("/proc/self/exe", argv);
+		}
+#endif
+
+	context = g_option_context_new (NULL);
+	g_option_context_set_summary (context, "Checks that memory reaches a steady state over a long map session.");
+	g_option_context_add_main_entries (context, entries, NULL);
+
+	error = NULL;
+	if (!g_option_context_parse (context, &argc, &argv, &error))
+		{
+			g_printerr ("%s\n", error->message);
+			return 1;
+		}
+	if (cycles <= 0 || every <= 0 || warmup < 0 || warmup >= 100 || tolerance < 0.0)
+		{
+			g_printerr ("%s", g_option_context_get_help (context, TRUE, NULL));
+			return 1;
+		}
+	g_option_context_free (context);
+
+	if (!gtk_init_check (&argc, &argv))
+		{
+			g_printerr ("No display, skipped.\n");
+			return 77;
+		}
+
+	stub = mapserv_stub_new (0, &error);
+	if (stub == NULL)
+		{
+			g_printerr ("%s\n", error->message);
+			return 1;
+		}
+
+	/* a private context, so nothing else fills or reads its cache */
+	ctx = gtk_mapserver_context_new ();
+
+	window = gtk_offscreen_window_new ();
+	gtkm = gtk_mapserver_new ();
+	g_object_set (G_OBJECT (gtkm),
+				  "context", ctx,
+				  "redraw-delay", 0,
+				  NULL);
+	g_signal_connect (gtkm, "rendered", G_CALLBACK (on_rendered), NULL);
+
+	width = 640;
+	height = 480;
+	gtk_widget_set_size_request (gtkm, width, height);
+	gtk_container_add (GTK_CONTAINER (window), gtkm);
+	gtk_widget_show_all (window);
+
+	home.minx = 0.0;
+	home.miny = 0.0;
+	home.maxx = 1000.0;
+	home.maxy = 1000.0;
+
+	rendered = FALSE;
+	gtk_mapserver_set_home (GTK_MAPSERVER (gtkm), mapserv_stub_get_url (stub), &home);
+	if (!wait_rendered ())
+		{
+			g_printerr ("The map was never rendered.\n");
+			return 1;
+		}
+
+	/* a resize at the same scale fetches only the exposed strip */
+	mapserv_stub_get_counts (stub, &requests, NULL);
+	pixels = mapserv_stub_get_pixels (stub);
+	rendered = FALSE;
+	gtk_widget_set_size_request (gtkm, width + 20, height);
+	if (!wait_rendered ())
+		{
+			g_printerr ("The widened map was never rendered.\n");
+			return 1;
+		}
+	mapserv_stub_get_counts (stub, &requests_after, NULL);
+	if (requests_after - requests != 1
+		|| mapserv_stub_get_pixels (stub) - pixels > (guint64)20 * height)
+		{
+			g_printerr ("Widening by 20 pixels took %u requests and %" G_GUINT64_FORMAT " pixels.\n",
+						requests_after - requests, mapserv_stub_get_pixels (stub) - pixels);
+			return 1;
+		}
+
+	requests = requests_after;
+	rendered = FALSE;
+	gtk_widget_set_size_request (gtkm, width, height);
+	if (!wait_rendered ())
+		{
+			g_printerr ("The narrowed map was never rendered.\n");
+			return 1;
+		}
+	mapserv_stub_get_counts (stub, &requests_after, NULL);
+	if (requests_after != requests)
+		{
+			g_printerr ("Narrowing took %u requests.\n", requests_after - requests);
+			return 1;
+		}
+
+	/* a strip left white by a failed request is not carried into the
+	 * next image */
+	gtk_mapserver_get_current_extent (GTK_MAPSERVER (gtkm), &ext);
+	step = (ext.maxx - ext.minx) / width * 10;
+	mapserv_stub_fail_next (stub, 1);
+	ext.minx += step;
+	ext.maxx += step;
+	rendered = FALSE;
+	gtk_mapserver_set_current_extent (GTK_MAPSERVER (gtkm), &ext);
+	if (!wait_rendered ())
+		{
+			g_printerr ("The pan with a failed strip was never rendered.\n");
+			return 1;
+		}
+
+	pixels = mapserv_stub_get_pixels (stub);
+	ext.minx += step;
+	ext.maxx += step;
+	rendered = FALSE;
+	gtk_mapserver_set_current_extent (GTK_MAPSERVER (gtkm), &ext);
+	if (!wait_rendered ())
+		{
+			g_printerr ("The pan after a failed strip was never rendered.\n");
+			return 1;
+		}
+	if (mapserv_stub_get_pixels (stub) - pixels <= (guint64)10 * height)
+		{
+			g_printerr ("The pan after a failed strip fetched only %" G_GUINT64_FORMAT " pixels.\n",
+						mapserv_stub_get_pixels (stub) - pixels);
+			return 1;
+		}
+
+	/* the views of the history stay pinned with L1 holding one image and
+	 * no L2 to fall back on */
+	g_object_get (G_OBJECT (ctx),
+				  "l1-size", &l1_size,
+				  "l2-size", &l2_size,
+				  NULL);
+	g_object_set (G_OBJECT (ctx),
+				  "l1-size", (guint64)width * height * 4,
+				  "l2-size", (guint64)0,
+				  NULL);
+	for (views = 1; views <= 6; views++)
+		{
+			/* disjoint views, each a full render */
+			ext.minx = home.minx + views * 2 * (home.maxx - home.minx);
+			ext.maxx = ext.minx + (home.maxx - home.minx);
+			ext.miny = home.miny;
+			ext.maxy = home.maxy;
+
+			rendered = FALSE;
+			gtk_mapserver_set_current_extent (GTK_MAPSERVER (gtkm), &ext);
+			if (!wait_rendered ())
+				{
+					g_printerr ("View %d was never rendered.\n", views);
+					return 1;
+				}
+		}
+
+	mapserv_stub_get_counts (stub, &requests, NULL);
+	for (views = 1; views < 6; views++)
+		{
+			rendered = FALSE;
+			if (!gtk_mapserver_go_back (GTK_MAPSERVER (gtkm)) || !wait_rendered ())
+				{
+					g_printerr ("Going back %d views was never rendered.\n", views);
+					return 1;
+				}
+		}
+	mapserv_stub_get_counts (stub, &requests_after, NULL);
+	if (requests_after != requests)
+		{
+			g_printerr ("Going back 5 views took %u requests.\n", requests_after - requests);
+			return 1;
+		}
+
+	g_object_set (G_OBJECT (ctx),
+				  "l1-size", l1_size,
+				  "l2-size", l2_size,
+				  NULL);
+
+	g_print ("%8s %10s %8s %8s %8s %10s %10s\n",
+			 "cycle", "rss kB", "pixbufs", "messages", "loaders", "l1 kB", "l2 kB");
+
+	rand = g_rand_new_with_seed (seed);
+	samples = g_array_new (FALSE, FALSE, sizeof (SoakSample));
+
+	level = 0;
+	col = STEPS / 2;
+	row = STEPS / 2;
+	failed = FALSE;
+	for (cycle = 1; cycle <= (guint)cycles && !failed; cycle++)
+		{
+			rendered = FALSE;
+
+			/* a random walk on a grid, so views repeat and hit the cache */
+			switch (g_rand_int_range (rand, 0, 10))
+				{
+					case 0:
+						level = 0;
+						col = STEPS / 2;
+						row = STEPS / 2;
+						break;
+
+					case 1:
+					case 2:
+						level = CLAMP (level + (g_rand_boolean (rand) ? 1 : -1), 0, LEVELS - 1);
+						break;
+
+					case 3:
+						{
+							static const gint sizes[][2] = { { 640, 480 }, { 800, 600 }, { 620, 480 }, { 1024, 700 } };
+							gint k;
+
+							do
+								{
+									k = g_rand_int_range (rand, 0, G_N_ELEMENTS (sizes));
+								}
+							while (sizes[k][0] == width && sizes[k][1] == height);
+
+							width = sizes[k][0];
+							height = sizes[k][1];
+							gtk_widget_set_size_request (gtkm, width, height);
+						}
+						break;
+
+					default:
+						col = CLAMP (col + g_rand_int_range (rand, -1, 2), 0, STEPS);
+						row = CLAMP (row + g_rand_int_range (rand, -1, 2), 0, STEPS);
+						break;
+				}
+
+			cx = home.minx + (home.maxx - home.minx) * col / STEPS;
+			cy = home.miny + (home.maxy - home.miny) * row / STEPS;
+			half = (home.maxx - home.minx) / 2.0 / (1 << level);
+
+			ext.minx = cx - half;
+			ext.miny = cy - half;
+			ext.maxx = cx + half;
+			ext.maxy = cy + half;
+			gtk_mapserver_set_current_extent (GTK_MAPSERVER (gtkm), &ext);
+
+			if (!wait_rendered ())
+				{
+					g_printerr ("Cycle %u was never rendered.\n", cycle);
+					failed = TRUE;
+				}
+
+			if (cycle % every == 0)
+				{
+					sample (ctx, cycle, &s);
+					g_array_append_val (samples, s);
+				}
+		}
+
+	/* the largest sample of the first checked half is the steady state
+	 * the largest of the last quarter is compared to */
+	memset (&baseline, 0, sizeof (SoakSample));
+	memset (&last, 0, sizeof (SoakSample));
+	for (i = 0; i < samples->len; i++)
+		{
+			SoakSample *c = &g_array_index (samples, SoakSample, i);
+			SoakSample *m;
+
+			if (c->cycle * 100 < (guint)cycles * warmup)
+				{
+					continue;
+				}
+			if (c->cycle * 100 < (guint)cycles * (warmup + (100 - warmup) / 2))
+				{
+					m = &baseline;
+				}
+			else if (c->cycle * 4 >= (guint)cycles * 3)
+				{
+					m = &last;
+				}
+			else
+				{
+					continue;
+				}
+
+			m->rss = MAX (m->rss, c->rss);
+			m->pixbufs = MAX (m->pixbufs, c->pixbufs);
+			m->messages = MAX (m->messages, c->messages);
+			m->loaders = MAX (m->loaders, c->loaders);
+		}
+
+	if (!failed)
+		{
+			failed = grows ("Resident memory (kB)", baseline.rss, last.rss, tolerance, 0)
+					 | grows ("GdkPixbuf count", baseline.pixbufs, last.pixbufs, tolerance, 4)
+					 | grows ("SoupMessage count", baseline.messages, last.messages, tolerance, 4)
+					 | grows ("GdkPixbufLoader count", baseline.loaders, last.loaders, tolerance, 4);
+		}
+
+	g_array_free (samples, TRUE);
+	g_rand_free (rand);
+
+	gtk_widget_destroy (window);
+	g_object_unref (ctx);
+	mapserv_stub_free (stub);
+
+	if (failed)
+		{
+			return 1;
+		}
+
+	g_print ("Steady state reached.\n");
+
+	return 0;
+}